@@ -0,0 +1,268 @@
+// Microbenchmarks for the intersection, traversal and shading kernels, and a throughput
+// benchmark for every scene in scenes/. Run with `make bench`, from the repository root.
+//
+// Every benchmark prints one JSON object per line on standard output, so runs can be saved and
+// compared by scripts; progress and the renderer's own logging go to standard error. Inputs are
+// drawn from fixed random streams, so every run times the same work. A kernel is timed over
+// repeated passes of at least min_pass_seconds each, and both the fastest and the median pass
+// are reported: the fastest is the better estimate of the kernel's cost on a noisy machine.
+//
+//   bench [filter]    Run only the benchmarks whose name contains filter.
+
+#include "common.h"
+
+#include "aabb.h"
+#include "bvh.h"
+#include "camera.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "perlin.h"
+#include "quad.h"
+#include "scene_loader.h"
+#include "sphere.h"
+#include "triangle.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+
+const int ray_count = 4096;
+const int pass_count = 7;
+const double min_pass_seconds = 0.05;
+
+std::string filter;
+volatile long long sink;  // Results are added here so the timed work can't be optimized away.
+
+bool selected(const std::string &name) {
+  return filter.empty() || name.find(filter) != std::string::npos;
+}
+
+template <typename Pass>
+void run(const std::string &name, long long ops_per_pass, Pass pass) {
+  // Time pass(), which performs ops_per_pass operations, and print the cost per operation.
+  if (!selected(name)) {
+    return;
+  }
+
+  using clock = std::chrono::steady_clock;
+  auto seconds = [](clock::duration d) { return std::chrono::duration<double>(d).count(); };
+
+  // Repeat the pass often enough that one timing is long compared to the clock's resolution.
+  long long repeats = 1;
+  for (;;) {
+    auto begin = clock::now();
+    for (long long i = 0; i < repeats; i++) {
+      sink = sink + pass();
+    }
+    if (seconds(clock::now() - begin) >= min_pass_seconds) {
+      break;
+    }
+    repeats *= 2;
+  }
+
+  std::vector<double> ns_per_op;
+  for (int p = 0; p < pass_count; p++) {
+    auto begin = clock::now();
+    for (long long i = 0; i < repeats; i++) {
+      sink = sink + pass();
+    }
+    ns_per_op.push_back(1e9 * seconds(clock::now() - begin) / (repeats * ops_per_pass));
+  }
+  std::sort(ns_per_op.begin(), ns_per_op.end());
+
+  std::printf("{\"benchmark\": \"%s\", \"ns_per_op\": %.3f, \"median_ns_per_op\": %.3f, "
+              "\"ops\": %lld}\n",
+              name.c_str(),
+              ns_per_op.front(),
+              ns_per_op[pass_count / 2],
+              repeats * ops_per_pass * pass_count);
+  std::fflush(stdout);
+}
+
+std::vector<ray> random_rays(uint64_t stream, real extent) {
+  // Rays from random points in a cube of the given half extent around the origin, aimed at
+  // random points in the unit cube, so that most of them pass near shapes placed there.
+  thread_rng().seed(0, stream);
+  std::vector<ray> rays;
+  for (int i = 0; i < ray_count; i++) {
+    auto origin = vec3::random(-extent, extent);
+    auto target = vec3::random(-1, 1);
+    rays.push_back(ray(origin, target - origin, random_double()));
+  }
+  return rays;
+}
+
+template <typename Shape>
+void bench_hit(const std::string &name, const Shape &shape, const std::vector<ray> &rays) {
+  run(name, ray_count, [&] {
+    long long hits = 0;
+    hit_record rec;
+    for (const auto &r : rays) {
+      hits += shape.hit(r, interval(0.001, infinity), rec);
+    }
+    return hits;
+  });
+}
+
+void bench_intersection() {
+  auto rays = random_rays(1, 4);
+  auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+
+  aabb box(point3(-1, -1, -1), point3(1, 1, 1));
+  run("aabb::hit", ray_count, [&] {
+    long long hits = 0;
+    for (const auto &r : rays) {
+      hits += box.hit(r, interval(0.001, infinity));
+    }
+    return hits;
+  });
+
+  bench_hit("sphere::hit", sphere(point3(0, 0, 0), 1, mat), rays);
+  bench_hit("quad::hit", quad(point3(-1, -1, 0), vec3(2, 0, 0), vec3(0, 2, 0), mat), rays);
+  bench_hit("triangle::hit",
+            triangle(point3(-1, -1, 0), point3(1, -1, 0), point3(0, 1, 0), mat),
+            rays);
+}
+
+void bench_traversal() {
+  if (!selected("bvh_node::hit")) {
+    return;
+  }
+
+  // Spheres of assorted sizes scattered through a cube, with the rays started outside it.
+  thread_rng().seed(0, 2);
+  auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+  hittable_list spheres;
+  for (int i = 0; i < 10000; i++) {
+    spheres.add(make_shared<sphere>(vec3::random(-1, 1), random_double(0.002, 0.02), mat));
+  }
+  bvh_node tree(spheres);
+
+  bench_hit("bvh_node::hit", tree, random_rays(3, 4));
+}
+
+void bench_noise() {
+  thread_rng().seed(0, 4);
+  perlin noise;
+  std::vector<point3> points;
+  for (int i = 0; i < ray_count; i++) {
+    points.push_back(vec3::random(-100, 100));
+  }
+
+  run("perlin::turb", ray_count, [&] {
+    double sum = 0;
+    for (const auto &p : points) {
+      sum += noise.turb(p, 7);
+    }
+    return static_cast<long long>(sum);
+  });
+}
+
+void bench_scatter(const std::string &name, shared_ptr<material> mat) {
+  if (!selected(name)) {
+    return;
+  }
+
+  // Finalized hits on a unit sphere, so every record has a real point, normal and uv.
+  auto rays = random_rays(5, 4);
+  sphere target(point3(0, 0, 0), 1, mat);
+  std::vector<ray> hit_rays;
+  std::vector<hit_record> hits;
+  for (const auto &r : rays) {
+    hit_record rec;
+    if (target.hit(r, interval(0.001, infinity), rec)) {
+      rec.finalize(r);
+      hit_rays.push_back(r);
+      hits.push_back(rec);
+    }
+  }
+
+  thread_rng().seed(0, 6);
+  run(name, static_cast<long long>(hits.size()), [&] {
+    long long scattered_count = 0;
+    for (size_t i = 0; i < hits.size(); i++) {
+      color attenuation;
+      ray scattered;
+      scattered_count += hits[i].mat->scatter(hit_rays[i], hits[i], 0, attenuation, scattered);
+    }
+    return scattered_count;
+  });
+}
+
+void bench_materials() {
+  bench_scatter("lambertian::scatter", make_shared<lambertian>(color(0.5, 0.5, 0.5)));
+  bench_scatter("metal::scatter", make_shared<metal>(color(0.8, 0.8, 0.8), 0.3));
+  bench_scatter("dielectric::scatter", make_shared<dielectric>(1.5));
+  bench_scatter("isotropic::scatter", make_shared<isotropic>(color(0.8, 0.8, 0.8)));
+}
+
+std::vector<std::string> scene_files(const std::string &directory) {
+  std::vector<std::string> files;
+  if (auto *dir = opendir(directory.c_str())) {
+    while (auto *entry = readdir(dir)) {
+      std::string name = entry->d_name;
+      if (name.size() > 6 && name.compare(name.size() - 6, 6, ".scene") == 0) {
+        files.push_back(directory + "/" + name);
+      }
+    }
+    closedir(dir);
+  }
+  std::sort(files.begin(), files.end());
+  return files;
+}
+
+void bench_scenes() {
+  // Render every scene small, with its own depth, on all hardware threads, three times over,
+  // and report the fastest render. A ray is one segment of a camera path; the shadow rays of
+  // light sampling are not counted.
+  for (const auto &file : scene_files("scenes")) {
+    auto name = "scene:" + file.substr(7, file.size() - 13);
+    if (!selected(name)) {
+      continue;
+    }
+
+    hittable_list world;
+    camera cam;
+    if (load_scene(file, world, cam)) {
+      cam.image_width = 160;
+      cam.samples_per_pixel = 8;
+      double seconds = infinity;
+      for (int i = 0; i < 3; i++) {
+        auto begin = std::chrono::steady_clock::now();
+        cam.render(world);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+        seconds = std::min(seconds, elapsed.count());
+      }
+
+      const auto &paths = cam.path_statistics();
+      auto samples = paths.paths();
+      auto rays = static_cast<long long>(paths.mean_length() * samples) +
+                  paths.paths_ending(path_stats::escaped);
+      std::printf("{\"benchmark\": \"%s\", \"seconds\": %.4f, \"samples\": %lld, "
+                  "\"rays\": %lld, \"rays_per_second\": %.0f}\n",
+                  name.c_str(),
+                  seconds,
+                  samples,
+                  rays,
+                  rays / seconds);
+      std::fflush(stdout);
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  if (argc > 1) {
+    filter = argv[1];
+  }
+
+  bench_intersection();
+  bench_traversal();
+  bench_noise();
+  bench_materials();
+  bench_scenes();
+}
@@ -4,42 +4,46 @@
 
 #include "common.h"
 
-class aabb {
+template <typename T>
+class basic_aabb {
  public:
+  using interval = basic_interval<T>;
+  using point3 = basic_vec3<T>;
+
   interval x, y, z;
-  static const aabb empty, universe;
+  static const basic_aabb empty, universe;
 
   // The default AABB is empty, since the intervals are empty by default.
-  aabb() {}
+  basic_aabb() {}
 
-  aabb(const interval &_x, const interval &_y, const interval &_z) : x(_x), y(_y), z(_z) {
+  basic_aabb(const interval &_x, const interval &_y, const interval &_z) : x(_x), y(_y), z(_z) {
     pad_to_minimums();
   }
 
-  aabb(const point3 &a, const point3 &b) {
+  basic_aabb(const point3 &a, const point3 &b) {
     // Treat the two points a and b as extrema for the bounding box, so we don't require a
     // particular min/max coordinate order
-    x = interval(fmin(a[0], b[0]), fmax(a[0], b[0]));
-    y = interval(fmin(a[1], b[1]), fmax(a[1], b[1]));
-    z = interval(fmin(a[2], b[2]), fmax(a[2], b[2]));
+    x = interval(std::fmin(a[0], b[0]), std::fmax(a[0], b[0]));
+    y = interval(std::fmin(a[1], b[1]), std::fmax(a[1], b[1]));
+    z = interval(std::fmin(a[2], b[2]), std::fmax(a[2], b[2]));
 
     pad_to_minimums();
   }
 
-  aabb(const aabb &box0, const aabb &box1) {
+  basic_aabb(const basic_aabb &box0, const basic_aabb &box1) {
     x = interval(box0.x, box1.x);
     y = interval(box0.y, box1.y);
     z = interval(box0.z, box1.z);
   }
 
-  aabb pad() {
+  basic_aabb pad() {
     // Return an AABB that has no side narrower than some delta, padding if necessary.
-    double delta = 0.0001;
+    T delta = 0.0001;
     interval new_x = (x.size() >= delta) ? x : x.expand(delta);
     interval new_y = (y.size() >= delta) ? y : y.expand(delta);
     interval new_z = (z.size() >= delta) ? z : z.expand(delta);
 
-    return aabb(new_x, new_y, new_z);
+    return basic_aabb(new_x, new_y, new_z);
   }
 
   const interval &axis(int n) const {
@@ -50,7 +54,7 @@ class aabb {
     return x;
   }
 
-  bool hit(const ray &r, interval ray_t) const {
+  bool hit(const basic_ray<T> &r, interval ray_t) const {
     for (int a = 0; a < 3; a++) {
       auto invD = 1 / r.direction()[a];
       auto orig = r.origin()[a];
@@ -77,6 +81,16 @@ class aabb {
     return true;
   }
 
+  T surface_area() const {
+    // Surface area of the box, used to estimate the odds of a ray hitting it.
+    auto dx = x.size(), dy = y.size(), dz = z.size();
+    return 2 * (dx * dy + dy * dz + dz * dx);
+  }
+
+  point3 centroid() const {
+    return point3(0.5 * (x.min + x.max), 0.5 * (y.min + y.max), 0.5 * (z.min + z.max));
+  }
+
   int longest_axis() const {
     // Returns the index of the longest axis of the bounding box.
     if (x.size() > y.size()) {
@@ -91,7 +105,7 @@ class aabb {
   void pad_to_minimums() {
     // Adjust the AABB so that no side is narrower than some delta, padding if necessary.
 
-    double delta = 0.0001;
+    T delta = 0.0001;
     if (x.size() < delta) {
       x = x.expand(delta);
     }
@@ -106,15 +120,23 @@ class aabb {
   }
 };
 
-const aabb aabb::empty = aabb(interval::empty, interval::empty, interval::empty);
-const aabb aabb::universe = aabb(interval::universe, interval::universe, interval::universe);
+template <typename T>
+const basic_aabb<T> basic_aabb<T>::empty =
+    basic_aabb<T>(basic_interval<T>::empty, basic_interval<T>::empty, basic_interval<T>::empty);
+template <typename T>
+const basic_aabb<T> basic_aabb<T>::universe = basic_aabb<T>(
+    basic_interval<T>::universe, basic_interval<T>::universe, basic_interval<T>::universe);
+
+using aabb = basic_aabb<real>;
 
-aabb operator+(const aabb &bbox, const vec3 &offset) {
-  return aabb(bbox.x + offset.x(), bbox.y + offset.y(), bbox.z + offset.z());
+template <typename T>
+basic_aabb<T> operator+(const basic_aabb<T> &bbox, const basic_vec3<T> &offset) {
+  return basic_aabb<T>(bbox.x + offset.x(), bbox.y + offset.y(), bbox.z + offset.z());
 }
 
-aabb operator+(const vec3 &offset, const aabb &bbox) {
+template <typename T>
+basic_aabb<T> operator+(const basic_vec3<T> &offset, const basic_aabb<T> &bbox) {
   return bbox + offset;
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -5,88 +5,822 @@
 
 #include "hittable.h"
 #include "hittable_list.h"
+#include "simd.h"
 
 #include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <vector>
 
-class bvh_node : public hittable {
+struct bvh_build_options {
+  int bin_count = 16;     // Buckets per axis when evaluating surface area heuristic splits.
+  int max_leaf_size = 4;  // Most primitives a leaf may hold.
+};
+
+struct bvh_build_stats {
+  size_t primitive_count = 0;
+  int node_count = 0;     // Interior nodes and leaves.
+  int leaf_count = 0;
+  int max_depth = 0;
+  double sah_cost = 0;    // Expected cost of a random ray, relative to one primitive test.
+  double build_time = 0;  // Seconds
+
+  void print(std::ostream &out) const {
+    out << "BVH: " << primitive_count << " primitives, " << node_count << " nodes, "
+        << leaf_count << " leaves, depth " << max_depth << ", SAH cost " << sah_cost
+        << ", built in " << build_time * 1000 << " ms\n";
+  }
+};
+
+struct bvh_split {
+  // How bvh_builder::split divided a span: [start, mid) and [mid, end), with their bounds.
+  size_t mid;
+  int axis;
+  aabb left_bounds, right_bounds;
+};
+
+class bvh_builder {
+  // Binned surface area heuristic (SAH) builder (Wald, "On fast Construction of SAH-based
+  // Bounding Volume Hierarchies"). The primitives are never copied: the builder partitions a
+  // single array of small records (bounds, centroid and index of a primitive) in place, so
+  // every node owns a contiguous span of it and each level of the build is a linear scan.
  public:
-  bvh_node(const hittable_list &list) : bvh_node(list.objects, 0, list.objects.size()) {}
+  bvh_builder(const std::vector<aabb> &primitive_bounds, const bvh_build_options &build_options)
+      : options(build_options) {
+    if (options.bin_count < 2) {
+      options.bin_count = 2;
+    }
+    if (options.max_leaf_size < 1) {
+      options.max_leaf_size = 1;
+    }
+    if (options.max_leaf_size > 65535) {
+      options.max_leaf_size = 65535;  // Leaf sizes are stored in 16 bits.
+    }
+    bins.resize(3 * options.bin_count);
+    right_area.resize(options.bin_count);
 
-  bvh_node(const std::vector<shared_ptr<hittable>> &src_objects, size_t start, size_t end) {
-    //  Build the bounding box of the span of source objects.
-    bbox = aabb::empty;
-    for (int object_index = start; object_index < end; object_index++) {
-      bbox = aabb(bbox, src_objects[object_index]->bounding_box());
+    records.resize(primitive_bounds.size());
+    for (size_t i = 0; i < records.size(); i++) {
+      records[i].bounds = primitive_bounds[i];
+      records[i].centroid = primitive_bounds[i].centroid();
+      records[i].index = i;
     }
+    stats.primitive_count = records.size();
+  }
 
-    int axis = bbox.longest_axis();
+  aabb span_bounds(size_t start, size_t end) const {
+    aabb box = aabb::empty;
+    for (size_t i = start; i < end; i++) {
+      grow(box, records[i].bounds);
+    }
+    return box;
+  }
 
-    auto comparator = (axis == 0) ? box_x_compare : (axis == 1) ? box_y_compare : box_z_compare;
+  bool split(size_t start, size_t end, const aabb &box, int depth, bvh_split &result) {
+    // Decide whether the span becomes a leaf. If not, reorder it so the left child owns
+    // [start, mid) and the right child owns [mid, end), describe the split in result and
+    // return true.
+    size_t count = end - start;
+    if (count <= 1) {
+      return false;
+    }
+    bool fits_leaf = count <= static_cast<size_t>(options.max_leaf_size);
 
-    //  A modifiable array of the source scene objects
-    auto objects = src_objects;
+    interval centroid_range[3];
+    for (size_t i = start; i < end; i++) {
+      const auto &c = records[i].centroid;
+      for (int a = 0; a < 3; a++) {
+        centroid_range[a] = interval(std::min(centroid_range[a].min, c[a]),
+                                     std::max(centroid_range[a].max, c[a]));
+      }
+    }
+
+    // Bin the primitives along all three axes in a single pass over the span.
+    const int bin_count = options.bin_count;
+    std::fill(bins.begin(), bins.end(), bin());
+    double scale[3];
+    for (int a = 0; a < 3; a++) {
+      auto size = centroid_range[a].size();
+      scale[a] = size > 0 ? bin_count / size : 0;
+    }
+    for (size_t i = start; i < end; i++) {
+      const auto &c = records[i].centroid;
+      const auto &box = records[i].bounds;
+      for (int a = 0; a < 3; a++) {
+        auto &b = bins[a * bin_count + bin_index(c[a], centroid_range[a].min, scale[a])];
+        b.count++;
+        grow(b.bounds, box);
+      }
+    }
 
-    size_t object_span = end - start;
+    // Find the cheapest bin boundary over all three axes.
+    double best_cost = infinity;
+    int best_axis = -1, best_split = 0;
 
-    if (object_span == 1) {
-      left = right = objects[start];
+    for (int a = 0; a < 3; a++) {
+      if (centroid_range[a].size() <= 0) {
+        continue;
+      }
+      const bin *axis_bins = &bins[a * bin_count];
+
+      // Sweep from the right to get the area of every right hand side.
+      aabb right = aabb::empty;
+      for (int b = bin_count - 1; b > 0; b--) {
+        grow(right, axis_bins[b].bounds);
+        right_area[b] = right.surface_area();
+      }
+
+      // Sweep from the left, evaluating the split in front of every bin.
+      aabb left = aabb::empty;
+      size_t left_count = 0;
+      for (int b = 1; b < bin_count; b++) {
+        grow(left, axis_bins[b - 1].bounds);
+        left_count += axis_bins[b - 1].count;
+        auto right_count = count - left_count;
+        if (left_count == 0 || right_count == 0) {
+          continue;
+        }
+
+        auto cost = left.surface_area() * left_count + right_area[b] * right_count;
+        if (cost < best_cost) {
+          best_cost = cost;
+          best_axis = a;
+          best_split = b;
+        }
+      }
     }
-    else if (object_span == 2) {
-      if (comparator(objects[start], objects[start + 1])) {
-        left = objects[start];
-        right = objects[start + 1];
+
+    // Relative SAH cost: one traversal step plus the area weighted primitive tests.
+    auto parent_area = box.surface_area();
+    auto split_cost = parent_area > 0 ? traversal_cost + best_cost / parent_area : infinity;
+
+    if (best_axis < 0 || depth >= max_sah_depth) {
+      // Either all centroids coincide, so no bin boundary separates them, or the tree is
+      // getting deep enough to threaten the traversal stack. Split the span in half along its
+      // widest centroid axis if it is too big for a leaf.
+      if (fits_leaf) {
+        return false;
       }
-      else {
-        left = objects[start + 1];
-        right = objects[start];
+      int axis = 0;
+      for (int a = 1; a < 3; a++) {
+        if (centroid_range[a].size() > centroid_range[axis].size()) {
+          axis = a;
+        }
       }
+      auto mid = start + count / 2;
+      auto by_centroid = [&](const record &a, const record &b) {
+        return a.centroid[axis] < b.centroid[axis];
+      };
+      std::nth_element(
+          records.begin() + start, records.begin() + mid, records.begin() + end, by_centroid);
+      result = bvh_split{mid, axis, span_bounds(start, mid), span_bounds(mid, end)};
+      return true;
+    }
+
+    if (fits_leaf && split_cost >= static_cast<double>(count)) {
+      return false;
     }
-    else {
-      std::sort(objects.begin() + start, objects.begin() + end, comparator);
 
-      auto mid = start + object_span / 2;
-      left = make_shared<bvh_node>(objects, start, mid);
-      right = make_shared<bvh_node>(objects, mid, end);
+    auto split_min = centroid_range[best_axis].min;
+    auto split_scale = scale[best_axis];
+    auto first_right = std::partition(
+        records.begin() + start, records.begin() + end, [&](const record &r) {
+          return bin_index(r.centroid[best_axis], split_min, split_scale) < best_split;
+        });
+    // The partition follows the bin boundary, so the children's bounds are those of their bins.
+    result.mid = first_right - records.begin();
+    result.axis = best_axis;
+    result.left_bounds = result.right_bounds = aabb::empty;
+    for (int b = 0; b < bin_count; b++) {
+      grow(b < best_split ? result.left_bounds : result.right_bounds,
+           bins[best_axis * bin_count + b].bounds);
     }
+    return true;
   }
 
-  bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
-    if (!bbox.hit(r, ray_t)) {
-      return false;
+  size_t primitive(size_t i) const {
+    // Index of the primitive at position i of the partitioned order.
+    return records[i].index;
+  }
+
+  void add_node(const aabb &box, size_t count, bool leaf, int depth, double root_area) {
+    // Record a finished node for the build statistics.
+    stats.node_count++;
+    stats.max_depth = std::max(stats.max_depth, depth);
+    auto area_ratio = root_area > 0 ? box.surface_area() / root_area : 1.0;
+    if (leaf) {
+      stats.leaf_count++;
+      stats.sah_cost += area_ratio * count;
+    }
+    else {
+      stats.sah_cost += area_ratio * traversal_cost;
+    }
+  }
+
+  const bvh_build_options &build_options() const {
+    return options;
+  }
+
+  bvh_build_stats stats;
+
+ private:
+  struct bin {
+    aabb bounds = aabb::empty;
+    size_t count = 0;
+  };
+
+  struct record {
+    aabb bounds;
+    point3 centroid;
+    size_t index;  // Position of the primitive in the bounds passed to the constructor.
+  };
+
+  static constexpr double traversal_cost = 1.0;  // Relative to one primitive test.
+  static const int max_sah_depth = 32;  // Deeper spans are halved, bounding the tree depth.
+
+  bvh_build_options options;
+  std::vector<record> records;
+  std::vector<bin> bins;          // Scratch space of split(), bin_count per axis.
+  std::vector<double> right_area;
+
+  static void grow(aabb &box, const aabb &other) {
+    // box = aabb(box, other), with comparisons that compile to plain min/max instructions
+    // rather than calls to fmin/fmax, which otherwise dominate the build time.
+    box.x = interval(std::min(box.x.min, other.x.min), std::max(box.x.max, other.x.max));
+    box.y = interval(std::min(box.y.min, other.y.min), std::max(box.y.max, other.y.max));
+    box.z = interval(std::min(box.z.min, other.z.min), std::max(box.z.max, other.z.max));
+  }
+
+  int bin_index(double centroid, double min, double scale) const {
+    auto b = static_cast<int>((centroid - min) * scale);
+    return std::min(std::max(b, 0), options.bin_count - 1);
+  }
+};
+
+struct linear_bvh_node {
+  // A node of the binary tree produced by the builder. Nodes are stored depth first, so the
+  // first child of an interior node always directly follows it and only the second child
+  // needs an index.
+  aabb bounds;
+  int offset;      // Leaf: first primitive. Interior: index of the second child.
+  uint16_t count;  // Primitives in a leaf, 0 for interior nodes.
+  uint8_t axis;    // Split axis of an interior node.
+};
+
+struct wide_bvh_node {
+  // A node with up to simd_width children (BVH8 with AVX2, BVH4 with SSE). The child boxes are
+  // stored as structure of arrays in single precision, rounded outward, so one ray is tested
+  // against all of them with a handful of vector instructions.
+  float min_x[simd_width], max_x[simd_width];
+  float min_y[simd_width], max_y[simd_width];
+  float min_z[simd_width], max_z[simd_width];
+  int32_t child[simd_width];   // Interior child: node index. Leaf: first primitive. Empty: -1.
+  uint16_t count[simd_width];  // Primitives in a leaf child, 0 for interior and empty slots.
+};
+
+class wide_bvh {
+  // The binary SAH tree collapsed into a contiguous, depth first array of wide nodes. The
+  // tree only knows the bounds of its primitives: a leaf refers to a span of the leaf order,
+  // and traversal hands those spans to a callback that intersects the primitives. That way the
+  // scene BVH and the triangles of a mesh share one builder and one traversal loop.
+  //
+  // The nodes are either built into the tree's own array, or borrowed from memory that outlives
+  // the tree, such as a mapped cache file (see adopt()).
+ public:
+  wide_bvh() {}
+  wide_bvh(const wide_bvh &) = delete;
+  wide_bvh &operator=(const wide_bvh &) = delete;
+
+  void build(const std::vector<aabb> &bounds, const bvh_build_options &options) {
+    auto begin = std::chrono::steady_clock::now();
+
+    bvh_builder builder(bounds, options);
+    bbox = builder.span_bounds(0, bounds.size());
+    owned_nodes.clear();
+
+    if (!bounds.empty()) {
+      std::vector<linear_bvh_node> binary_nodes;
+      binary_nodes.reserve(2 * bounds.size());
+      build(binary_nodes, builder, 0, bounds.size(), bbox, 0, bbox.surface_area());
+      collapse(binary_nodes, 0);
     }
 
-    bool hit_left = left->hit(r, ray_t, rec);
-    bool hit_right = right->hit(r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
+    order.resize(bounds.size());
+    for (size_t i = 0; i < bounds.size(); i++) {
+      order[i] = builder.primitive(i);
+    }
 
-    return hit_left || hit_right;
+    builder.stats.build_time =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    stats = builder.stats;
+    bvh_build_seconds() += stats.build_time;
+    nodes = owned_nodes.data();
+    nodes_end = nodes + owned_nodes.size();
   }
 
-  aabb bounding_box() const override {
+  void adopt(const wide_bvh_node *first,
+             size_t count,
+             const aabb &box,
+             const bvh_build_stats &build_stats) {
+    // Traverse count nodes built earlier, in place. The tree has no leaf order then, so
+    // primitive() must not be used: the primitives have to be stored in leaf order already.
+    owned_nodes = std::vector<wide_bvh_node>();
+    order = std::vector<size_t>();
+    nodes = first;
+    nodes_end = first + count;
+    bbox = box;
+    stats = build_stats;
+  }
+
+  bool empty() const {
+    return nodes == nodes_end;
+  }
+
+  const wide_bvh_node *node_data() const {
+    return nodes;
+  }
+
+  size_t node_count() const {
+    return static_cast<size_t>(nodes_end - nodes);
+  }
+
+  const aabb &bounds() const {
     return bbox;
   }
 
+  size_t primitive(size_t i) const {
+    // Index, in the bounds passed to build(), of the primitive at position i of the leaf order.
+    return order[i];
+  }
+
+  const bvh_build_stats &build_stats() const {
+    return stats;
+  }
+
+  template <typename leaf_hit>
+  bool hit(const ray &r, interval &ray_t, leaf_hit &&hit_leaf) const {
+    // Find the closest hit along r. hit_leaf(first, count, ray_t) intersects the primitives
+    // [first, first + count) of the leaf order, shrinks ray_t.max to the closest hit and
+    // returns whether there was one.
+    if (empty()) {
+      return false;
+    }
+    return hit_subtree(0, r, ray_t, hit_leaf);
+  }
+
+  template <typename leaf_hit>
+  int hit_packet(const ray_packet &packet,
+                 real t_min,
+                 real t_max[],
+                 int active,
+                 leaf_hit &&hit_leaf) const {
+    // Traverse the tree once for the whole packet. The lanes hold the rays, and every child
+    // box of a node is tested against all of them with one vectorized slab test, so a subtree
+    // is visited whenever at least one active ray enters it. hit_leaf(first, count, lanes)
+    // intersects a leaf's primitives with the given lanes, shrinks their t_max and returns the
+    // lanes that hit.
+    if (empty() || active == 0) {
+      return 0;
+    }
+
+    const int n = ray_packet::size;
+    float lane_origin[3][n], lane_inv_dir[3][n], lane_t_max[n];
+    for (int k = 0; k < n; k++) {
+      for (int a = 0; a < 3; a++) {
+        lane_origin[a][k] = static_cast<float>(packet.origin[a][k]);
+        lane_inv_dir[a][k] = static_cast<float>(1 / packet.direction[a][k]);
+      }
+      lane_t_max[k] = static_cast<float>(t_max[k]);
+    }
+    simd_float origin_x = simd_float::load(lane_origin[0]);
+    simd_float origin_y = simd_float::load(lane_origin[1]);
+    simd_float origin_z = simd_float::load(lane_origin[2]);
+    simd_float inv_dir_x = simd_float::load(lane_inv_dir[0]);
+    simd_float inv_dir_y = simd_float::load(lane_inv_dir[1]);
+    simd_float inv_dir_z = simd_float::load(lane_inv_dir[2]);
+    simd_float packet_t_min(static_cast<float>(t_min));
+
+    int hits = 0;
+    packet_stack_entry stack[max_stack_size];
+    int stack_size = 0;
+    stack[stack_size++] =
+        packet_stack_entry{0, 0, active, -std::numeric_limits<float>::infinity()};
+
+    while (stack_size > 0) {
+      auto entry = stack[--stack_size];
+
+      if (entry.count > 0) {
+        HEMERA_COUNT(stat_bvh_leaves);
+        hits |= hit_leaf(entry.index, entry.count, entry.lanes);
+        for (int k = 0; k < n; k++) {
+          lane_t_max[k] = static_cast<float>(t_max[k]);
+        }
+        continue;
+      }
+
+      // Drop the lanes that have found a hit in front of this box since it was pushed.
+      for (int k = 0; k < n; k++) {
+        if (lane_t_max[k] < entry.t_near) {
+          entry.lanes &= ~(1 << k);
+        }
+      }
+      if (entry.lanes == 0) {
+        continue;
+      }
+
+      // A subtree that only a few lanes entered is cheaper to traverse one ray at a time, since
+      // the packet's slab test costs a full vector per child whatever the lanes do.
+      if (lane_count(entry.lanes) <= n / 4) {
+        for (int k = 0; k < n; k++) {
+          if (!(entry.lanes & (1 << k))) {
+            continue;
+          }
+          int lane = 1 << k;
+          interval ray_t(t_min, t_max[k]);
+          auto hit_lane = [&](int first, int count, interval &leaf_t) {
+            if (!hit_leaf(first, count, lane)) {
+              return false;
+            }
+            leaf_t.max = t_max[k];
+            return true;
+          };
+          if (hit_subtree(entry.index, packet.rays[k], ray_t, hit_lane)) {
+            hits |= lane;
+          }
+          lane_t_max[k] = static_cast<float>(t_max[k]);
+        }
+        continue;
+      }
+
+      HEMERA_COUNT(stat_bvh_packet_nodes);
+      const auto &node = nodes[entry.index];
+      simd_float packet_t_max = simd_float::load(lane_t_max);
+      int first = stack_size;
+      for (int c = 0; c < simd_width; c++) {
+        if (node.child[c] < 0) {
+          continue;
+        }
+
+        // Near and far planes differ per lane here, so take the min and max of both slabs.
+        auto t0x = (simd_float(node.min_x[c]) - origin_x) * inv_dir_x;
+        auto t1x = (simd_float(node.max_x[c]) - origin_x) * inv_dir_x;
+        auto t0y = (simd_float(node.min_y[c]) - origin_y) * inv_dir_y;
+        auto t1y = (simd_float(node.max_y[c]) - origin_y) * inv_dir_y;
+        auto t0z = (simd_float(node.min_z[c]) - origin_z) * inv_dir_z;
+        auto t1z = (simd_float(node.max_z[c]) - origin_z) * inv_dir_z;
+
+        auto t_enter = simd_max(simd_min(t0z, t1z),
+                                simd_max(simd_min(t0y, t1y),
+                                         simd_max(simd_min(t0x, t1x), packet_t_min)));
+        auto t_exit = simd_min(simd_max(t0z, t1z),
+                               simd_min(simd_max(t0y, t1y),
+                                        simd_min(simd_max(t0x, t1x), packet_t_max)));
+        t_enter = t_enter - simd_abs(t_enter) * simd_float(slab_epsilon);
+        t_exit = t_exit + simd_abs(t_exit) * simd_float(slab_epsilon);
+
+        int lanes = less_equal_mask(t_enter, t_exit) & entry.lanes;
+        if (lanes == 0) {
+          continue;
+        }
+
+        // Order the hit children far to near by the first entry of any lane into them.
+        float t_enter_lanes[simd_width];
+        t_enter.store(t_enter_lanes);
+        float t_near = std::numeric_limits<float>::infinity();
+        for (int k = 0; k < n; k++) {
+          if (lanes & (1 << k)) {
+            t_near = std::min(t_near, t_enter_lanes[k]);
+          }
+        }
+
+        packet_stack_entry child{node.child[c], node.count[c], lanes, t_near};
+        int j = stack_size++;
+        while (j > first && stack[j - 1].t_near < child.t_near) {
+          stack[j] = stack[j - 1];
+          j--;
+        }
+        stack[j] = child;
+      }
+    }
+
+    return hits;
+  }
+
  private:
-  shared_ptr<hittable> left;
-  shared_ptr<hittable> right;
+  struct stack_entry {
+    int32_t index;  // Node index, or first primitive of a leaf.
+    int32_t count;  // Primitives in a leaf, 0 for a node.
+    float t_near;   // Where the ray enters the entry's box.
+  };
+
+  struct packet_stack_entry {
+    int32_t index;  // Node index, or first primitive of a leaf.
+    int32_t count;  // Primitives in a leaf, 0 for a node.
+    int lanes;      // Packet lanes that entered the entry's box.
+    float t_near;   // Earliest entry of any of those lanes into the box.
+  };
+
+  // The builder bounds the binary depth to 64, and every wide level pushes at most
+  // simd_width - 1 entries beyond the one it pops.
+  static const int max_stack_size = 64 * simd_width;
+  static constexpr float slab_epsilon = 4e-7f;
+
+  std::vector<wide_bvh_node> owned_nodes;
+  const wide_bvh_node *nodes = nullptr;  // The nodes traversed: owned_nodes or adopted ones.
+  const wide_bvh_node *nodes_end = nullptr;
+  std::vector<size_t> order;  // Primitive indices in leaf order.
   aabb bbox;
+  bvh_build_stats stats;
+
+  template <typename leaf_hit>
+  bool hit_subtree(int root, const ray &r, interval &ray_t, leaf_hit &hit_leaf) const {
+    // hit(), starting from the interior node root instead of the top of the tree.
+    // Per ray constants for the slab tests. With a negative direction the near plane of a
+    // slab is its max, so the planes are picked once here instead of swapping per node.
+    auto origin = r.origin();
+    auto direction = r.direction();
+    float inv_dir[3];
+    for (int a = 0; a < 3; a++) {
+      inv_dir[a] = static_cast<float>(1 / direction[a]);
+    }
+    bool neg_x = inv_dir[0] < 0, neg_y = inv_dir[1] < 0, neg_z = inv_dir[2] < 0;
+
+    simd_float origin_x(static_cast<float>(origin.x()));
+    simd_float origin_y(static_cast<float>(origin.y()));
+    simd_float origin_z(static_cast<float>(origin.z()));
+    simd_float inv_dir_x(inv_dir[0]), inv_dir_y(inv_dir[1]), inv_dir_z(inv_dir[2]);
+    simd_float t_min(static_cast<float>(ray_t.min));
+
+    bool hit_anything = false;
+    stack_entry stack[max_stack_size];
+    int stack_size = 0;
+    stack[stack_size++] = stack_entry{root, 0, -std::numeric_limits<float>::infinity()};
+
+    while (stack_size > 0) {
+      auto entry = stack[--stack_size];
+      if (entry.t_near > ray_t.max) {
+        continue;  // A closer hit was found since this entry was pushed.
+      }
+
+      if (entry.count > 0) {
+        HEMERA_COUNT(stat_bvh_leaves);
+        if (hit_leaf(entry.index, entry.count, ray_t)) {
+          hit_anything = true;
+        }
+        continue;
+      }
+
+      HEMERA_COUNT(stat_bvh_nodes);
+      const auto &node = nodes[entry.index];
+      auto t_near_x = (simd_float::load(neg_x ? node.max_x : node.min_x) - origin_x) * inv_dir_x;
+      auto t_near_y = (simd_float::load(neg_y ? node.max_y : node.min_y) - origin_y) * inv_dir_y;
+      auto t_near_z = (simd_float::load(neg_z ? node.max_z : node.min_z) - origin_z) * inv_dir_z;
+      auto t_far_x = (simd_float::load(neg_x ? node.min_x : node.max_x) - origin_x) * inv_dir_x;
+      auto t_far_y = (simd_float::load(neg_y ? node.min_y : node.max_y) - origin_y) * inv_dir_y;
+      auto t_far_z = (simd_float::load(neg_z ? node.min_z : node.max_z) - origin_z) * inv_dir_z;
+
+      // A NaN (zero direction component with the origin on a slab plane) takes the other
+      // operand, so it never rejects a box. Widening the interval by a few ulps of its ends keeps
+      // the float test conservative against the double precision primitive tests. The widening
+      // goes by magnitude, since the ends are negative when the origin is inside or past a box.
+      auto t_enter = simd_max(t_near_z, simd_max(t_near_y, simd_max(t_near_x, t_min)));
+      auto t_exit = simd_min(t_far_z,
+                             simd_min(t_far_y,
+                                      simd_min(t_far_x,
+                                               simd_float(static_cast<float>(ray_t.max)))));
+      t_enter = t_enter - simd_abs(t_enter) * simd_float(slab_epsilon);
+      t_exit = t_exit + simd_abs(t_exit) * simd_float(slab_epsilon);
+      int mask = less_equal_mask(t_enter, t_exit);
+      if (mask == 0) {
+        continue;
+      }
+
+      // Push the hit children far to near, so the nearest one is traversed first.
+      float t_enter_lanes[simd_width];
+      t_enter.store(t_enter_lanes);
+      int first = stack_size;
+      for (int k = 0; k < simd_width; k++) {
+        if (!(mask & (1 << k)) || node.child[k] < 0) {
+          continue;
+        }
+        stack_entry child{node.child[k], node.count[k], t_enter_lanes[k]};
+        int j = stack_size++;
+        while (j > first && stack[j - 1].t_near < child.t_near) {
+          stack[j] = stack[j - 1];
+          j--;
+        }
+        stack[j] = child;
+      }
+    }
+
+    return hit_anything;
+  }
+
+  int build(std::vector<linear_bvh_node> &binary_nodes,
+            bvh_builder &builder,
+            size_t start,
+            size_t end,
+            const aabb &box,
+            int depth,
+            double root_area) {
+    // Append the binary subtree for the span [start, end) in depth first order and return the
+    // index of its root.
+    int index = static_cast<int>(binary_nodes.size());
+    binary_nodes.push_back(linear_bvh_node());
+    binary_nodes[index].bounds = box;
+
+    bvh_split split;
+    if (!builder.split(start, end, box, depth, split)) {
+      builder.add_node(box, end - start, true, depth, root_area);
+      binary_nodes[index].offset = static_cast<int>(start);
+      binary_nodes[index].count = static_cast<uint16_t>(end - start);
+      binary_nodes[index].axis = 0;
+      return index;
+    }
+
+    builder.add_node(box, end - start, false, depth, root_area);
+    build(binary_nodes, builder, start, split.mid, split.left_bounds, depth + 1, root_area);
+    int second = build(
+        binary_nodes, builder, split.mid, end, split.right_bounds, depth + 1, root_area);
+
+    binary_nodes[index].offset = second;
+    binary_nodes[index].count = 0;
+    binary_nodes[index].axis = static_cast<uint8_t>(split.axis);
+    return index;
+  }
+
+  int collapse(const std::vector<linear_bvh_node> &binary_nodes, int binary_index) {
+    // Turn the binary subtree rooted at binary_index into a wide node and return its index.
+    // The wide node's children are found by repeatedly opening up the interior child with the
+    // largest surface area until all simd_width slots are used.
+    std::vector<int> children;
+    const auto &root = binary_nodes[binary_index];
+    if (root.count > 0) {
+      children.push_back(binary_index);  // Only happens for a root that is a leaf.
+    }
+    else {
+      children.push_back(binary_index + 1);
+      children.push_back(root.offset);
+    }
+
+    while (static_cast<int>(children.size()) < simd_width) {
+      int widest = -1;
+      for (size_t k = 0; k < children.size(); k++) {
+        const auto &candidate = binary_nodes[children[k]];
+        if (candidate.count == 0 &&
+            (widest < 0 || candidate.bounds.surface_area() >
+                               binary_nodes[children[widest]].bounds.surface_area()))
+        {
+          widest = static_cast<int>(k);
+        }
+      }
+      if (widest < 0) {
+        break;
+      }
+      int opened = children[widest];
+      children[widest] = opened + 1;
+      children.push_back(binary_nodes[opened].offset);
+    }
 
-  static bool box_compare(const shared_ptr<hittable> a,
-                          const shared_ptr<hittable> b,
-                          int axis_index) {
-    return a->bounding_box().axis(axis_index).min < b->bounding_box().axis(axis_index).min;
+    int index = static_cast<int>(owned_nodes.size());
+    owned_nodes.push_back(wide_bvh_node());
+    for (int k = 0; k < simd_width; k++) {
+      set_child_bounds(owned_nodes[index], k, aabb::empty);
+      owned_nodes[index].child[k] = -1;
+      owned_nodes[index].count[k] = 0;
+    }
+
+    for (size_t k = 0; k < children.size(); k++) {
+      const auto &child = binary_nodes[children[k]];
+      if (child.count > 0) {
+        set_child_bounds(owned_nodes[index], k, child.bounds);
+        owned_nodes[index].child[k] = child.offset;
+        owned_nodes[index].count[k] = child.count;
+      }
+      else {
+        int child_index = collapse(binary_nodes, children[k]);
+        set_child_bounds(owned_nodes[index], k, child.bounds);
+        owned_nodes[index].child[k] = child_index;
+      }
+    }
+    return index;
   }
 
-  static bool box_x_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
-    return box_compare(a, b, 0);
+  static void set_child_bounds(wide_bvh_node &node, int k, const aabb &box) {
+    // Store a child box in single precision, rounding outward so it still encloses the
+    // double precision box. It is padded by a few float ulps on top of that, to cover the
+    // rounding of the ray origin to single precision during traversal.
+    const float inf = std::numeric_limits<float>::infinity();
+    node.min_x[k] = round_down(box.x.min);
+    node.max_x[k] = round_up(box.x.max);
+    node.min_y[k] = round_down(box.y.min);
+    node.max_y[k] = round_up(box.y.max);
+    node.min_z[k] = round_down(box.z.min);
+    node.max_z[k] = round_up(box.z.max);
+
+    if (box.x.min > box.x.max) {
+      // Empty slot: an inverted box that no ray can enter.
+      node.min_x[k] = node.min_y[k] = node.min_z[k] = inf;
+      node.max_x[k] = node.max_y[k] = node.max_z[k] = -inf;
+    }
   }
 
-  static bool box_y_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
-    return box_compare(a, b, 1);
+  static float round_down(double x) {
+    x -= fabs(x) * 1e-6;
+    auto f = static_cast<float>(x);
+    return f > x ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
   }
 
-  static bool box_z_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
-    return box_compare(a, b, 2);
+  static float round_up(double x) {
+    x += fabs(x) * 1e-6;
+    auto f = static_cast<float>(x);
+    return f < x ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
   }
 };
 
-#endif
\ No newline at end of file
+class bvh_node : public hittable {
+  // Bounding volume hierarchy over the objects of a list, with the objects stored in leaf
+  // order. Traversal is a loop over a wide_bvh with an explicit stack instead of virtual calls
+  // through a tree of shared pointers.
+ public:
+  bvh_node(const hittable_list &list) : bvh_node(list, bvh_build_options()) {}
+
+  bvh_node(const hittable_list &list, const bvh_build_options &options) {
+    std::vector<aabb> bounds;
+    bounds.reserve(list.objects.size());
+    for (const auto &object : list.objects) {
+      bounds.push_back(object->bounding_box());
+    }
+
+    tree.build(bounds, options);
+
+    primitives.reserve(bounds.size());
+    for (size_t i = 0; i < bounds.size(); i++) {
+      primitives.push_back(list.objects[tree.primitive(i)]);
+    }
+  }
+
+  bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
+    return tree.hit(r, ray_t, [&](int first, int count, interval &leaf_t) {
+      bool hit_anything = false;
+      for (int i = first; i < first + count; i++) {
+        if (primitives[i]->hit(r, leaf_t, rec)) {
+          hit_anything = true;
+          leaf_t.max = rec.t;
+        }
+      }
+      return hit_anything;
+    });
+  }
+
+  int hit_packet(const ray_packet &packet,
+                 real t_min,
+                 real t_max[],
+                 hit_record rec[],
+                 int active) const override {
+    return tree.hit_packet(packet, t_min, t_max, active, [&](int first, int count, int lanes) {
+      // Once only a few lanes are left the packet has lost its coherence, and the primitives
+      // are cheaper to intersect one ray at a time with the base class fallback.
+      bool coherent = lane_count(lanes) > ray_packet::size / 4;
+      int hits = 0;
+      for (int i = first; i < first + count; i++) {
+        const auto &object = *primitives[i];
+        hits |= coherent ? object.hit_packet(packet, t_min, t_max, rec, lanes)
+                         : object.hittable::hit_packet(packet, t_min, t_max, rec, lanes);
+      }
+      return hits;
+    });
+  }
+
+  void gather_lights(std::vector<const hittable *> &lights) const override {
+    for (const auto &object : primitives) {
+      object->gather_lights(lights);
+    }
+  }
+
+  bool records_instances() const override {
+    for (const auto &object : primitives) {
+      if (object->records_instances()) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  aabb bounding_box() const override {
+    return tree.bounds();
+  }
+
+  const bvh_build_stats &build_stats() const {
+    return tree.build_stats();
+  }
+
+ private:
+  wide_bvh tree;
+  std::vector<shared_ptr<hittable>> primitives;
+};
+
+#endif
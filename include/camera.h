@@ -4,17 +4,122 @@
 #include "common.h"
 
 #include "color.h"
+#include "cost_map.h"
+#include "framebuffer.h"
 #include "hittable.h"
 #include "material.h"
+#include "ray_packet.h"
+#include "thread_pool.h"
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <mutex>
+#include <vector>
+
+class path_stats {
+  // How many surfaces each traced path hit before it ended, and what ended it.
+ public:
+  enum ending { escaped, absorbed, roulette, depth_limit, ending_count };
+
+  path_stats() : ends() {}
+
+  void add_path(int length, ending end) {
+    if (length >= static_cast<int>(lengths.size())) {
+      lengths.resize(length + 1, 0);
+    }
+    lengths[length]++;
+    ends[end]++;
+  }
+
+  void merge(const path_stats &other) {
+    if (other.lengths.size() > lengths.size()) {
+      lengths.resize(other.lengths.size(), 0);
+    }
+    for (size_t i = 0; i < other.lengths.size(); i++) {
+      lengths[i] += other.lengths[i];
+    }
+    for (int e = 0; e < ending_count; e++) {
+      ends[e] += other.ends[e];
+    }
+  }
+
+  long long paths() const {
+    long long total = 0;
+    for (int e = 0; e < ending_count; e++) {
+      total += ends[e];
+    }
+    return total;
+  }
+
+  long long paths_with_length(int length) const {
+    return length < static_cast<int>(lengths.size()) ? lengths[length] : 0;
+  }
+
+  long long paths_ending(ending end) const {
+    return ends[end];
+  }
+
+  long long total_length() const {
+    // Surfaces hit by all the paths together.
+    long long total = 0;
+    for (size_t i = 0; i < lengths.size(); i++) {
+      total += static_cast<long long>(i) * lengths[i];
+    }
+    return total;
+  }
+
+  double mean_length() const {
+    return paths() > 0 ? static_cast<double>(total_length()) / paths() : 0;
+  }
+
+  void print(std::ostream &out) const {
+    auto total = paths();
+    if (total == 0) {
+      return;
+    }
+    static const char *names[ending_count] = {"escaped", "absorbed", "roulette", "depth limit"};
+    out << "Paths: " << total << ", mean length " << mean_length() << ", ended by";
+    for (int e = 0; e < ending_count; e++) {
+      out << (e > 0 ? ", " : " ") << names[e] << ' ' << 100.0 * ends[e] / total << '%';
+    }
+    out << "\nPath lengths:";
+    for (size_t i = 0; i < lengths.size(); i++) {
+      if (lengths[i] > 0) {
+        out << ' ' << i << ':' << lengths[i];
+      }
+    }
+    out << '\n';
+  }
+
+  void write_json(std::ostream &out) const {
+    // The same as print(), as a JSON object.
+    static const char *names[ending_count] = {"escaped", "absorbed", "roulette", "depth_limit"};
+    out << "{\"paths\": " << paths() << ", \"mean_length\": " << mean_length()
+        << ", \"ended_by\": {";
+    for (int e = 0; e < ending_count; e++) {
+      out << (e > 0 ? ", " : "") << '"' << names[e] << "\": " << ends[e];
+    }
+    out << "}, \"lengths\": [";
+    for (size_t i = 0; i < lengths.size(); i++) {
+      out << (i > 0 ? ", " : "") << lengths[i];
+    }
+    out << "]}";
+  }
+
+ private:
+  std::vector<long long> lengths;  // Paths that hit exactly i surfaces.
+  long long ends[ending_count];    // Paths that ended each way.
+};
 
 class camera {
  public:
   double aspect_ratio = 1.0;   // Ratio of image width over height.
   int image_width = 100;       // Rendered image width in pixel count.
-  int samples_per_pixel = 10;  // Count of random samples for each pixel.
+  int samples_per_pixel = 10;  // Count of random samples for each pixel (average if adaptive).
   int max_depth = 10;          // Max number of ray bounces into scene.
+  int roulette_depth = 5;      // Bounces before Russian roulette may end a path (-1 = never).
+  bool light_sampling = true;  // Sample emissive quads and spheres directly at diffuse hits.
   color background;            // Scene background color.
 
   double vfov = 90;                    // Vertical view angle (field of view)
@@ -25,24 +130,68 @@ class camera {
   double defocus_angle = 0;  // Variation angle of rays through each pixel.
   double focus_dist = 10;    // Distance from camera lookfrom point to plane of perfect focus.
 
+  uint64_t seed = 0;   // Seed for the per-sample random number streams.
+  int threads = 0;     // Worker threads used for rendering (0 = all hardware threads).
+  int tile_size = 16;  // Width and height, in pixels, of the square tiles handed to workers.
+  // Trace the camera rays of neighbouring pixels as one packet, and the light sample rays from
+  // their first hits as another. Off by default: against the wide BVH, whose single ray slab
+  // test already fills the vector lanes, packets measure slower on every scene in scenes/.
+  bool packet_tracing = false;
+
+  // Adaptive sampling stops sampling a pixel once its estimate has converged, then spends the
+  // samples converged pixels saved on the ones still above the threshold, in a second pass that
+  // raises their cap. The image keeps the budget of samples_per_pixel samples per pixel.
+  bool adaptive_sampling = false;     // Stop sampling a pixel once its estimate has converged.
+  int min_samples = 16;               // Samples every pixel takes before checking convergence.
+  double adaptive_threshold = 0.005;  // On-screen standard error at which a pixel has converged.
+  int adaptive_sample_limit = 4;      // Most samples a pixel takes, in samples_per_pixel.
+
+  bool record_costs = false;  // Measure every pixel's cost (see cost_map.h), without packets.
+
   void render(const hittable &world) {
     initialize();
 
-    std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+    // Every pixel is accumulated into its own slot, so the tiles can finish in any order.
+    frame.resize(image_width, image_height);
+    paths = path_stats();
+    costs = cost_map();
+    if (record_costs) {
+      costs.resize(image_width, image_height);
+    }
 
-    // Start from bottom left corner, scan each line left to right, top to bottom.
-    for (int j = 0; j < image_height; j++) {
-      std::clog << "\r Scanlines remaining: " << (image_height - j) << ' ' << std::flush;
-      for (int i = 0; i < image_width; i++) {
-        color pixel_color(0, 0, 0);
-        for (int sample = 0; sample < samples_per_pixel; ++sample) {
-          ray r = get_ray(i, j);
-          pixel_color += ray_color(r, max_depth, world);
-        }
-        write_color(std::cout, pixel_color, samples_per_pixel);
-      }
+    lights.clear();
+    if (light_sampling) {
+      world.gather_lights(lights);
     }
-    std::clog << "\rDone.     \n";
+
+    auto begin = std::chrono::steady_clock::now();
+    thread_pool pool(threads);
+    render_pass(world, pool, samples_per_pixel);
+
+    int sample_cap = adaptive_sampling ? redistributed_sample_cap() : 0;
+    if (sample_cap > samples_per_pixel) {
+      std::clog << "Resampling noisy pixels with up to " << sample_cap << " samples\n";
+      render_pass(world, pool, sample_cap);
+    }
+
+    std::clog << "Done.\n";
+    report_throughput(std::chrono::steady_clock::now() - begin);
+    paths.print(std::clog);
+  }
+
+  const framebuffer &image() const {
+    // The linear color of every pixel from the last render.
+    return frame;
+  }
+
+  const path_stats &path_statistics() const {
+    // How long the paths of the last render were and how they ended.
+    return paths;
+  }
+
+  const cost_map &pixel_costs() const {
+    // What each pixel of the last render cost, if record_costs was set.
+    return costs;
   }
 
  private:
@@ -51,9 +200,290 @@ class camera {
   point3 pixel00_loc;   // Location of pixel 0, 0
   vec3 pixel_delta_u;   // Offset to pixel to the right
   vec3 pixel_delta_v;   // Offset to pixel below
+  double pixel_spread;  // Angle a pixel subtends, how fast ray cones widen
   vec3 u, v, w;         // Camera frame basis vectors
   vec3 defocus_disk_u;  // Defocus disc horizontal radius
   vec3 defocus_disk_v;  // Defocus disc vertical radius
+  framebuffer frame;    // Rendered pixel colors
+  path_stats paths;     // Path lengths of the last render
+  cost_map costs;       // Per pixel costs of the last render
+  std::vector<const hittable *> lights;  // Emissive objects sampled at every diffuse hit
+
+  void report_throughput(std::chrono::steady_clock::duration elapsed) const {
+    // Print how many camera samples were traced and how fast.
+    auto total_samples = frame.total_samples();
+    auto seconds = std::chrono::duration<double>(elapsed).count();
+    std::clog << "Traced " << total_samples << " samples ("
+              << static_cast<double>(total_samples) / (image_width * image_height)
+              << " per pixel) in " << seconds << " s, " << total_samples / seconds
+              << " samples/s\n";
+  }
+
+  void render_pass(const hittable &world, thread_pool &pool, int sample_cap) {
+    // Sample every pixel that needs it up to sample_cap samples, continuing from what earlier
+    // passes left in the frame.
+    int tiles_x = (image_width + tile_size - 1) / tile_size;
+    int tiles_y = (image_height + tile_size - 1) / tile_size;
+    int tile_count = tiles_x * tiles_y;
+    int tiles_done = 0;  // Guarded by progress_mutex, so the counts print in order.
+    std::mutex progress_mutex;
+    std::clog << "Rendering " << tile_count << " tiles on " << pool.size() << " threads\n";
+
+    // Submit tiles top to bottom. Workers run their own tiles in submission order, so they sweep
+    // the image roughly in scanline order, and steal from the bottom of each other's share.
+    for (int tile = 0; tile < tile_count; tile++) {
+      pool.submit([&, tile] {
+        int x0 = (tile % tiles_x) * tile_size;
+        int y0 = (tile / tiles_x) * tile_size;
+        path_stats tile_paths;
+        render_tile(world, x0, y0, sample_cap, tile_paths);
+
+        std::lock_guard<std::mutex> lock(progress_mutex);
+        tiles_done++;
+        paths.merge(tile_paths);
+        std::clog << "\r Tiles remaining: " << (tile_count - tiles_done) << ' ' << std::flush;
+      });
+    }
+    pool.wait();
+    std::clog << "\r                      \r";
+  }
+
+  int redistributed_sample_cap() const {
+    // The sample cap that spends the samples converged pixels saved on the pixels still above
+    // the threshold, or 0 if there are none. Pixels that stayed black through all their samples
+    // are left out: they are mostly background, which no amount of samples lights up.
+    long long budget = static_cast<long long>(image_width) * image_height * samples_per_pixel;
+    long long saved = budget - frame.total_samples();
+    long long noisy = 0;
+    for (int j = 0; j < image_height; j++) {
+      for (int i = 0; i < image_width; i++) {
+        auto estimate = frame.estimate(i, j);
+        if (!estimate.dark() && !converged(estimate, estimate.samples() - 1)) {
+          noisy++;
+        }
+      }
+    }
+    if (noisy == 0) {
+      return 0;
+    }
+    auto extra = std::min(saved / noisy,
+                          static_cast<long long>(adaptive_sample_limit - 1) * samples_per_pixel);
+    return samples_per_pixel + static_cast<int>(extra);
+  }
+
+  bool needs_samples(const pixel_estimator &estimate, int sample_cap) const {
+    // Whether a pixel sampled by earlier passes should take more samples under the new cap.
+    int count = estimate.samples();
+    if (count == 0) {
+      return true;
+    }
+    return count < sample_cap && !estimate.dark() && !converged(estimate, count - 1);
+  }
+
+  void render_tile(const hittable &world, int x0, int y0, int sample_cap, path_stats &stats) {
+    // Trace the samples up to sample_cap of the pixels inside the tile whose upper left corner
+    // is x0,y0. Only the first pass, which starts every pixel from nothing, traces packets.
+    int x1 = std::min(x0 + tile_size, image_width);
+    int y1 = std::min(y0 + tile_size, image_height);
+
+    for (int j = y0; j < y1; j++) {
+      if (record_costs) {
+        for (int i = x0; i < x1; i++) {
+          render_measured_pixel(world, i, j, sample_cap, stats);
+        }
+      }
+      else if (packet_tracing && sample_cap == samples_per_pixel) {
+        for (int i = x0; i < x1; i += ray_packet::size) {
+          render_packet(world, i, std::min(i + ray_packet::size, x1), j, stats);
+        }
+      }
+      else {
+        for (int i = x0; i < x1; i++) {
+          render_pixel(world, i, j, sample_cap, stats);
+        }
+      }
+    }
+  }
+
+  void render_pixel(const hittable &world, int i, int j, int sample_cap, path_stats &stats) {
+    auto estimate = frame.estimate(i, j);
+    if (!needs_samples(estimate, sample_cap)) {
+      return;
+    }
+    for (int sample = estimate.samples(); sample < sample_cap; ++sample) {
+      seed_sample(i, j, sample);
+      ray r = get_ray(i, j);
+      estimate.add(ray_color(r, max_depth, world, stats));
+
+      if (converged(estimate, sample)) {
+        break;
+      }
+    }
+    frame.set_pixel(i, j, estimate);
+  }
+
+  void render_measured_pixel(const hittable &world,
+                             int i,
+                             int j,
+                             int sample_cap,
+                             path_stats &stats) {
+    // Render one pixel and add what it cost to its earlier passes. Pixels are traced one at a
+    // time in this mode, since the lanes of a packet share their traversal and its cost can't be
+    // split among them.
+    uint64_t before[stat_count], after[stat_count];
+    auto samples_before = frame.sample_count(i, j);
+    auto paths_before = stats.paths();
+    auto length_before = stats.total_length();
+    thread_counts(before);
+    auto begin = std::chrono::steady_clock::now();
+
+    render_pixel(world, i, j, sample_cap, stats);
+
+    auto elapsed = std::chrono::steady_clock::now() - begin;
+    thread_counts(after);
+    auto counted = [&](stat_counter c) { return static_cast<double>(after[c] - before[c]); };
+
+    auto add = [&](int kind, double value) {
+      costs.set(i, j, kind, costs.value(i, j, kind) + value);
+    };
+
+    add(cost_time, std::chrono::duration<double>(elapsed).count());
+    // Every sample traces one path, so the mean depth so far weighs in by its sample count.
+    auto pixel_paths = stats.paths() - paths_before;
+    auto pixel_length = stats.total_length() - length_before;
+    auto all_paths = samples_before + pixel_paths;
+    if (all_paths > 0) {
+      auto earlier_length = costs.value(i, j, cost_path_depth) * samples_before;
+      costs.set(i, j, cost_path_depth, (earlier_length + pixel_length) / all_paths);
+    }
+    add(cost_bvh_nodes, counted(stat_bvh_nodes) + counted(stat_bvh_leaves));
+    add(cost_primitive_tests,
+        counted(stat_sphere_tests) + counted(stat_quad_tests) + counted(stat_triangle_tests) +
+            counted(stat_mesh_triangle_tests) + counted(stat_medium_tests) +
+            counted(stat_volume_tests));
+  }
+
+  void render_packet(const hittable &world, int i0, int i1, int j, path_stats &stats) {
+    // Render the pixels [i0, i1) of row j, tracing the camera rays of each sample as one
+    // packet, and the light sample rays from their first hits as a second one. After that the
+    // rays of a packet no longer travel in similar directions, so the rest of each path is
+    // traced on its own.
+    const int n = ray_packet::size;
+    pixel_estimator estimate[n];
+    pcg32 lane_rng[n];
+    hit_record rec[n];
+    real t_max[n];
+    path_state path[n];
+    hit_record light_rec[n];
+    real light_t_max[n];
+    double light_weight[n];
+
+    int unconverged = (1 << (i1 - i0)) - 1;
+    for (int sample = 0; sample < samples_per_pixel && unconverged != 0; ++sample) {
+      ray_packet packet;
+      packet.rng = lane_rng;
+      for (int lane = 0; lane < n; lane++) {
+        if (unconverged & (1 << lane)) {
+          seed_sample(i0 + lane, j, sample);
+          packet.set(lane, get_ray(i0 + lane, j));
+          lane_rng[lane] = thread_rng();
+          t_max[lane] = infinity;
+        }
+        else {
+          t_max[lane] = 0;  // An empty interval, so the lane's masked out math stays finite.
+        }
+      }
+
+      if (max_depth <= 0) {
+        for (int lane = 0; lane < n; lane++) {
+          if (unconverged & (1 << lane)) {
+            stats.add_path(0, path_stats::depth_limit);
+            estimate[lane].add(color(0, 0, 0));
+            if (converged(estimate[lane], sample)) {
+              unconverged &= ~(1 << lane);
+            }
+          }
+        }
+        continue;
+      }
+
+      HEMERA_COUNT_N(stat_camera_rays, lane_count(packet.active));
+      int hits = world.hit_packet(packet, 0.001, t_max, rec, packet.active);
+
+      // Shade the first hits, one lane at a time with the random stream of the lane's sample,
+      // and gather the light sample rays of the paths that go on.
+      ray_packet light_packet;
+      light_packet.rng = lane_rng;
+      int going_on = 0;
+      for (int lane = 0; lane < n; lane++) {
+        light_t_max[lane] = 0;
+        if (!(unconverged & (1 << lane))) {
+          continue;
+        }
+        thread_rng() = lane_rng[lane];
+        path[lane] = path_state(packet.rays[lane], (hits & (1 << lane)) != 0, rec[lane]);
+        if (shade(path[lane], max_depth, stats)) {
+          going_on |= 1 << lane;
+          ray to_light;
+          if (samples_light(path[lane]) &&
+              light_ray(path[lane].r, path[lane].rec, to_light, light_weight[lane]))
+          {
+            light_packet.set(lane, to_light);
+            light_t_max[lane] = infinity;
+          }
+        }
+        lane_rng[lane] = thread_rng();
+      }
+
+      int light_hits = 0;
+      if (light_packet.active != 0) {
+        HEMERA_COUNT_N(stat_shadow_rays, lane_count(light_packet.active));
+        light_hits =
+            world.hit_packet(light_packet, 0.001, light_t_max, light_rec, light_packet.active);
+      }
+
+      for (int lane = 0; lane < n; lane++) {
+        if (!(unconverged & (1 << lane))) {
+          continue;
+        }
+        // Carry on with the random stream this lane's sample left off with.
+        thread_rng() = lane_rng[lane];
+        if (going_on & (1 << lane)) {
+          color direct(0, 0, 0);
+          if (light_packet.active & (1 << lane)) {
+            direct = light_arriving(light_packet.rays[lane],
+                                    (light_hits & (1 << lane)) != 0,
+                                    light_rec[lane],
+                                    light_weight[lane]);
+          }
+          if (advance(path[lane], direct, world, stats)) {
+            follow(path[lane], max_depth, world, stats);
+          }
+        }
+        estimate[lane].add(path[lane].radiance);
+        if (converged(estimate[lane], sample)) {
+          unconverged &= ~(1 << lane);
+        }
+      }
+    }
+
+    for (int i = i0; i < i1; i++) {
+      frame.set_pixel(i, j, estimate[i - i0]);
+    }
+  }
+
+  bool converged(const pixel_estimator &estimate, int sample) const {
+    // Whether adaptive sampling may stop after the given (zero based) sample.
+    return adaptive_sampling && sample + 1 >= min_samples &&
+           estimate.display_error() < adaptive_threshold;
+  }
+
+  void seed_sample(int i, int j, int sample) const {
+    // Give every sample of every pixel its own random stream, so the image depends only on the
+    // seed and not on the number of threads or the order the tiles were traced in.
+    auto pixel_index = static_cast<uint64_t>(j) * image_width + i;
+    thread_rng().seed(seed, (pixel_index << 32) | static_cast<uint32_t>(sample));
+  }
 
   void initialize() {
     // Calculate the image height, and ensure that it's at least 1.
@@ -84,6 +514,7 @@ class camera {
      */
     pixel_delta_u = viewport_u / image_width;
     pixel_delta_v = viewport_v / image_height;
+    pixel_spread = atan(2 * h / image_height);
 
     // Calculate the location of the upper left pixel
     auto viewport_upper_left = center - (focus_dist * w) - viewport_u / 2 - viewport_v / 2;
@@ -122,29 +553,214 @@ class camera {
     return center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
   }
 
-  color ray_color(const ray &r, int depth, const hittable &world) const {
-    hit_record rec;
-
-    //  If we've exceeded ray bounce limit, no more light is gathered.
+  color ray_color(const ray &r, int depth, const hittable &world, path_stats &stats) const {
+    // Radiance arriving along r, following the path for at most depth bounces.
     if (depth <= 0) {
+      stats.add_path(0, path_stats::depth_limit);
       return color(0, 0, 0);
     }
 
-    // If the ray hits nothing, return the background color.
-    if (!world.hit(r, interval(0.001, infinity), rec)) {
-      return background;
-    }
+    HEMERA_COUNT(stat_camera_rays);
+    hit_record rec;
+    bool hit = world.hit(r, interval(0.001, infinity), rec);
+    return trace_path(r, hit, rec, depth, world, stats);
+  }
+
+  struct path_state {
+    // A path being followed by trace_path: the ray it is on and that ray's closest hit (not yet
+    // finalized, if hit is set), the light gathered so far in radiance and the product of the
+    // attenuations along the path in throughput.
+    ray r;
+    bool hit = false;
+    hit_record rec;
+    color radiance = color(0, 0, 0);
+    color throughput = color(1, 1, 1);
+    point3 scatter_origin;
+    double scatter_pdf = 0;  // Density the last bounce was sampled with, zero if specular.
+    double cone_width = 0;
+    int bounce = 0;
+
+    // The bounce that shade() chose at the current vertex.
     ray scattered;
     color attenuation;
-    color color_from_emission = rec.mat->emitted(rec.u, rec.v, rec.p);
 
-    if (!rec.mat->scatter(r, rec, attenuation, scattered)) {
-      return color_from_emission;
+    path_state() {}
+    path_state(const ray &r, bool hit, const hit_record &rec) : r(r), hit(hit), rec(rec) {}
+  };
+
+  color trace_path(const ray &r,
+                   bool hit,
+                   const hit_record &rec,
+                   int depth,
+                   const hittable &world,
+                   path_stats &stats) const {
+    // Follow a path whose first intersection (rec, if hit is set) has already been found, but
+    // not yet finalized. Each bounce is one iteration instead of one level of recursion.
+    //
+    // At every vertex whose material has a scattering pdf, one light is also sampled directly
+    // (next event estimation). Emission reached by either strategy is weighted with the power
+    // heuristic, so light found both ways is not counted twice.
+    //
+    // Each path also carries a ray cone, widening by pixel_spread per unit of distance from the
+    // camera, whose width where it meets a surface sets how much texture lookups are filtered.
+    path_state path(r, hit, rec);
+    follow(path, depth, world, stats);
+    return path.radiance;
+  }
+
+  void follow(path_state &path, int depth, const hittable &world, path_stats &stats) const {
+    // Trace the path vertex by vertex until it ends.
+    while (shade(path, depth, stats)) {
+      color direct(0, 0, 0);
+      if (samples_light(path)) {
+        direct = sample_light(path.r, path.rec, world);
+      }
+      if (!advance(path, direct, world, stats)) {
+        return;
+      }
+    }
+  }
+
+  bool shade(path_state &path, int depth, path_stats &stats) const {
+    // Add the emission at the path's current hit and choose the bounce from it. Returns false,
+    // and records how the path ended, if there is nothing more to follow.
+    if (!path.hit) {
+      stats.add_path(path.bounce, path_stats::escaped);
+      path.radiance += path.throughput * background;
+      return false;
+    }
+    auto &r = path.r;
+    auto &rec = path.rec;
+    rec.finalize(r);
+
+    // The cone meets the surface obliquely, stretching its footprint by 1 / cos.
+    auto distance = rec.t * r.direction().length();
+    path.cone_width += pixel_spread * distance;
+    auto cosine = fabs(dot(unit_vector(r.direction()), rec.normal));
+    auto footprint = rec.uv_density * path.cone_width / fmax(cosine, 0.1);
+
+    if (rec.mat->is_emissive()) {
+      HEMERA_COUNT(stat_emitter_hits);
+      auto weight = 1.0;
+      if (path.scatter_pdf > 0 && !lights.empty()) {
+        weight = power_heuristic(path.scatter_pdf, light_pdf(path.scatter_origin, r.direction()));
+      }
+      path.radiance += weight * path.throughput * rec.mat->emitted(rec.u, rec.v, rec.p);
     }
 
-    color color_from_scatter = attenuation * ray_color(scattered, depth - 1, world);
+    if (!rec.mat->scatter(r, rec, footprint, path.attenuation, path.scattered)) {
+      stats.add_path(path.bounce + 1, path_stats::absorbed);
+      return false;
+    }
+
+    if (path.bounce + 1 >= depth) {
+      stats.add_path(path.bounce + 1, path_stats::depth_limit);
+      return false;
+    }
+
+    auto direction = path.scattered.direction();
+    path.scatter_pdf = rec.mat->scattering_pdf(r, rec, path.scattered);
+    path.scatter_origin = rec.p;
+    path.scattered = ray(offset_ray_origin(rec.p, rec.normal, direction),
+                         direction,
+                         path.scattered.time());
+    return true;
+  }
+
+  bool samples_light(const path_state &path) const {
+    // Whether the vertex shade() just left the path at takes a light sample.
+    return path.scatter_pdf > 0 && !lights.empty();
+  }
+
+  bool advance(path_state &path, const color &direct, const hittable &world, path_stats &stats)
+      const {
+    // Add the light sampled directly at the current vertex (zero if none) and move the path
+    // along the bounce shade() chose, tracing it to its next hit. Returns false if Russian
+    // roulette ends the path instead.
+    path.radiance += path.throughput * path.attenuation * direct;
+    path.throughput = path.throughput * path.attenuation;
+    path.bounce++;
+
+    // Russian roulette: past roulette_depth, continue with probability equal to the largest
+    // throughput component and divide the survivors by it. Paths that can only add a little
+    // light are mostly dropped, while the expected value stays the same.
+    if (roulette_depth >= 0 && path.bounce >= roulette_depth) {
+      auto survival = fmax(path.throughput.x(), fmax(path.throughput.y(), path.throughput.z()));
+      if (survival < 1) {
+        if (random_double() >= survival) {
+          stats.add_path(path.bounce, path_stats::roulette);
+          return false;
+        }
+        path.throughput /= survival;
+      }
+    }
+
+    path.r = path.scattered;
+    HEMERA_COUNT(stat_bounce_rays);
+    path.hit = world.hit(path.r, interval(0.001, infinity), path.rec);
+    return true;
+  }
+
+  color sample_light(const ray &r, const hit_record &rec, const hittable &world) const {
+    // Light arriving at rec from a direction chosen by sampling one of the lights, divided by
+    // the attenuation (which the caller applies). The sample ray is traced through the whole
+    // scene, so an occluder, or another emitter in front of the light, is handled like any
+    // other hit.
+    ray to_light;
+    double weight;
+    if (!light_ray(r, rec, to_light, weight)) {
+      return color(0, 0, 0);
+    }
+
+    HEMERA_COUNT(stat_shadow_rays);
+    hit_record light_rec;
+    bool hit = world.hit(to_light, interval(0.001, infinity), light_rec);
+    return light_arriving(to_light, hit, light_rec, weight);
+  }
+
+  bool light_ray(const ray &r, const hit_record &rec, ray &to_light, double &weight) const {
+    // Pick a light and a direction towards it from rec. Returns false if the sample can't
+    // carry any light; otherwise weight is what the light's emission is multiplied by.
+    auto light = lights[random_int(0, static_cast<int>(lights.size()) - 1)];
+    auto direction = light->random(rec.p);
+    to_light = ray(offset_ray_origin(rec.p, rec.normal, direction), direction, r.time());
+
+    auto pdf = light_pdf(rec.p, to_light.direction());
+    auto scatter_pdf = rec.mat->scattering_pdf(r, rec, to_light);
+    if (pdf <= 0 || scatter_pdf <= 0) {
+      return false;
+    }
+    weight = power_heuristic(pdf, scatter_pdf) * scatter_pdf / pdf;
+    return true;
+  }
+
+  static color light_arriving(const ray &to_light, bool hit, hit_record &light_rec, double weight) {
+    // The weighted emission a light sample ray found, given its closest hit.
+    if (!hit) {
+      return color(0, 0, 0);
+    }
+    light_rec.finalize(to_light);
+    if (!light_rec.mat->is_emissive()) {
+      return color(0, 0, 0);
+    }
+    return weight * light_rec.mat->emitted(light_rec.u, light_rec.v, light_rec.p);
+  }
+
+  double light_pdf(const point3 &origin, const vec3 &direction) const {
+    // Density of sample_light choosing the direction: one light is picked uniformly.
+    auto sum = 0.0;
+    for (auto light : lights) {
+      sum += light->pdf_value(origin, direction);
+    }
+    return sum / lights.size();
+  }
 
-    return color_from_emission + color_from_scatter;
+  static double power_heuristic(double pdf, double other_pdf) {
+    // Multiple importance sampling weight of a sample drawn with pdf, when other_pdf could also
+    // have produced it.
+    auto a = pdf * pdf;
+    auto b = other_pdf * other_pdf;
+    return a / (a + b);
   }
 };
 
@@ -3,36 +3,16 @@
 
 #include "vec3.h"
 
-#include <iostream>
-
 using color = vec3;
 
 inline double linear_to_gamma(double linear_component) {
   return sqrt(linear_component);
 }
 
-void write_color(std::ostream &out, color pixel_color, int samples_per_pixel) {
-  // TODO, look into function alas for RGB
-  auto r = pixel_color.x();
-  auto g = pixel_color.y();
-  auto b = pixel_color.z();
-
-  // Divide the color by the number of samples.
-  auto scale = 1.0 / samples_per_pixel;
-  r *= scale;
-  g *= scale;
-  b *= scale;
-
-  // Apply the linear to gamma transform.
-  r = linear_to_gamma(r);
-  g = linear_to_gamma(g);
-  b = linear_to_gamma(b);
-
-  // Write the translated [0,255] value of each color component
+inline unsigned char linear_to_byte(double linear_component) {
+  // Apply the linear to gamma transform and translate the result to a [0,255] value.
   static const interval intensity(0.000, 0.999);
-  out << static_cast<int>(256 * intensity.clamp(r)) << ' '
-      << static_cast<int>(256 * intensity.clamp(g)) << ' '
-      << static_cast<int>(256 * intensity.clamp(b)) << '\n';
+  return static_cast<unsigned char>(256 * intensity.clamp(linear_to_gamma(linear_component)));
 }
 
-#endif
\ No newline at end of file
+#endif
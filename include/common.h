@@ -5,6 +5,18 @@
 #include <cstdlib>
 #include <limits>
 #include <memory>
+#include <string>
+
+#include "rng.h"
+
+// The scalar type of the geometry and shading math. Building with HEMERA_FLOAT (make
+// PRECISION=float) renders in single precision, halving the size of vertices, rays and hit
+// records; the default double build is the reference.
+#ifdef HEMERA_FLOAT
+using real = float;
+#else
+using real = double;
+#endif
 
 // Usings
 using std::make_shared;
@@ -20,7 +32,7 @@ inline double degrees_to_radians(double degrees) {
 
 inline double random_double() {
   // Return a random real in [0,1).
-  return rand() / (RAND_MAX + 1.0);
+  return thread_rng().next_double();
 }
 
 inline double random_double(double min, double max) {
@@ -33,6 +45,11 @@ inline int random_int(int min, int max) {
   return int(random_double(min, max + 1));
 }
 
+inline bool has_extension(const std::string &path, const std::string &extension) {
+  return path.size() >= extension.size() &&
+         path.compare(path.size() - extension.size(), extension.size(), extension) == 0;
+}
+
 #include "interval.h"
 #include "ray.h"
 #include "vec3.h"
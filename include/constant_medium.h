@@ -19,59 +19,61 @@ class constant_medium : public hittable {
     // Print occasional samples when debugging. To enable, set enableDebug true.
     const bool enableDebug = false;
     const bool debug_samples = enableDebug && random_double() < 0.00001;
+    HEMERA_COUNT(stat_medium_tests);
 
-    hit_record rec1, rec2;
-
-    if (!boundary->hit(r, interval::universe, rec1)) {
-      return false;
-    }
-
-    if (!boundary->hit(r, interval(rec1.t + 0.0001, infinity), rec2)) {
+    // Where the ray's line enters and leaves the boundary, found in one query.
+    interval inside;
+    if (!boundary->hit_interval(r, inside)) {
       return false;
     }
 
     if (debug_samples) {
-      std::clog << "\nray_tmin=" << rec1.t << ", ray_max=" << rec2.t << '\n';
+      std::clog << "\nray_tmin=" << inside.min << ", ray_max=" << inside.max << '\n';
     }
 
-    if (rec1.t < ray_t.min) {
-      rec1.t = ray_t.min;
+    if (inside.min < ray_t.min) {
+      inside.min = ray_t.min;
     }
 
-    if (rec2.t > ray_t.max) {
-      rec2.t = ray_t.max;
+    if (inside.max > ray_t.max) {
+      inside.max = ray_t.max;
     }
 
-    if (rec1.t >= rec2.t) {
+    if (inside.min >= inside.max) {
       return false;
     }
 
-    if (rec1.t < 0) {
-      rec1.t = 0;
+    if (inside.min < 0) {
+      inside.min = 0;
     }
 
     auto ray_length = r.direction().length();
-    auto distance_inside_boundary = (rec2.t - rec1.t) * ray_length;
+    auto distance_inside_boundary = (inside.max - inside.min) * ray_length;
     auto hit_distance = neg_inv_density * log(random_double());
 
     if (hit_distance > distance_inside_boundary) {
       return false;
     }
 
-    rec.t = rec1.t + hit_distance / ray_length;
-    rec.p = r.at(rec.t);
+    rec.t = inside.min + hit_distance / ray_length;
+    rec.object = this;
 
     if (debug_samples) {
       std::clog << "hit_distance = " << hit_distance << '\n'
                 << "rec.t = " << rec.t << '\n'
-                << "rec.p = " << rec.p << '\n';
+                << "rec.p = " << r.at(rec.t) << '\n';
     }
 
+    HEMERA_COUNT(stat_medium_scatters);
+    return true;
+  }
+
+  void finalize(const ray &r, hit_record &rec) const override {
+    rec.p = r.at(rec.t);
     rec.normal = vec3(1, 0, 0);  // Arbitrary
     rec.front_face = true;       // Also arbitrary
-    rec.mat = phase_function;
-
-    return true;
+    rec.mat = phase_function.get();
+    rec.uv_density = 0;
   }
 
   aabb bounding_box() const override {
@@ -80,7 +82,7 @@ class constant_medium : public hittable {
 
  private:
   shared_ptr<hittable> boundary;
-  double neg_inv_density;
+  real neg_inv_density;
   shared_ptr<material> phase_function;
 };
 
@@ -0,0 +1,101 @@
+#ifndef COST_MAP_H
+#define COST_MAP_H
+// Per pixel measurements of what a render cost, shown as false colour heatmaps: the wall clock
+// time spent on each pixel, the mean length of its paths and, in a build with HEMERA_STATS, the
+// BVH nodes it visited and the intersection tests it ran. The camera records them when
+// record_costs is set (see camera.h).
+
+#include "color.h"
+#include "framebuffer.h"
+#include "render_stats.h"
+
+#include <algorithm>
+#include <vector>
+
+enum cost_kind {
+  cost_time,             // Seconds spent on the pixel, all samples together
+  cost_path_depth,       // Mean number of surfaces hit by the pixel's paths
+  cost_bvh_nodes,        // Interior nodes and leaves visited, all samples together
+  cost_primitive_tests,  // Shape and medium intersection tests, all samples together
+  cost_kind_count
+};
+
+inline const char *cost_name(int kind) {
+  static const char *names[cost_kind_count] = {"time", "depth", "bvh_nodes", "tests"};
+  return names[kind];
+}
+
+class cost_map {
+ public:
+  void resize(int width, int height) {
+    map_width = width;
+    map_height = height;
+    for (auto &kind : values) {
+      kind.assign(static_cast<size_t>(width) * height, 0.0f);
+    }
+  }
+
+  bool has(int kind) const {
+    // The node and test counts come from the render counters, which only exist when compiled in.
+    return map_width > 0 && (kind < cost_bvh_nodes || stats_enabled());
+  }
+
+  void set(int x, int y, int kind, double value) {
+    values[kind][static_cast<size_t>(y) * map_width + x] = static_cast<float>(value);
+  }
+
+  double value(int x, int y, int kind) const {
+    return values[kind][static_cast<size_t>(y) * map_width + x];
+  }
+
+  double scale(int kind) const {
+    // The value shown at the top of the colour ramp: the 99th percentile, so a few outlying
+    // pixels don't leave the rest of the map dark.
+    if (values[kind].empty()) {
+      return 0;
+    }
+    auto sorted = values[kind];
+    auto top = sorted.begin() + (sorted.size() - 1) * 99 / 100;
+    std::nth_element(sorted.begin(), top, sorted.end());
+    return *top;
+  }
+
+  framebuffer heatmap(int kind) const {
+    // The map with every value divided by scale(kind) and looked up in the colour ramp.
+    framebuffer image(map_width, map_height);
+    auto top = scale(kind);
+    for (int y = 0; y < map_height; y++) {
+      for (int x = 0; x < map_width; x++) {
+        auto t = top > 0 ? std::min(value(x, y, kind) / top, 1.0) : 0.0;
+        image.set_pixel(x, y, false_color(t));
+      }
+    }
+    return image;
+  }
+
+  static color false_color(double t) {
+    // A ramp from black through purple, red and orange to pale yellow, close to matplotlib's
+    // inferno, so cost reads as brightness. The stops are given as displayed and squared into
+    // linear values, since the image writers apply a square root gamma.
+    static const double stops[5][3] = {{0.00, 0.00, 0.02},
+                                       {0.34, 0.06, 0.43},
+                                       {0.73, 0.21, 0.33},
+                                       {0.98, 0.55, 0.04},
+                                       {0.99, 1.00, 0.64}};
+    auto position = t * 4;
+    int i = std::min(static_cast<int>(position), 3);
+    auto f = position - i;
+    double rgb[3];
+    for (int c = 0; c < 3; c++) {
+      auto display = stops[i][c] + f * (stops[i + 1][c] - stops[i][c]);
+      rgb[c] = display * display;
+    }
+    return color(rgb[0], rgb[1], rgb[2]);
+  }
+
+ private:
+  int map_width = 0, map_height = 0;
+  std::vector<float> values[cost_kind_count];
+};
+
+#endif
@@ -0,0 +1,152 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "color.h"
+
+#include <vector>
+
+class pixel_estimator {
+  // Running mean of a pixel's samples, plus the variance of their luminance using Welford's
+  // online algorithm, so convergence can be checked without keeping the samples around.
+ public:
+  pixel_estimator() : count(0), mean(0, 0, 0), mean_luminance(0), m2(0) {}
+
+  pixel_estimator(int count, const color &mean, double variance)
+      : count(count),
+        mean(mean),
+        mean_luminance(luminance(mean)),
+        m2(count > 1 ? variance * (count - 1) : 0) {}
+
+  void add(const color &sample) {
+    count++;
+    mean += (sample - mean) / count;
+
+    auto y = luminance(sample);
+    auto delta = y - mean_luminance;
+    mean_luminance += delta / count;
+    m2 += delta * (y - mean_luminance);
+  }
+
+  int samples() const {
+    return count;
+  }
+
+  color value() const {
+    return mean;
+  }
+
+  double variance() const {
+    // Sample variance of the luminance.
+    return count > 1 ? m2 / (count - 1) : 0;
+  }
+
+  bool dark() const {
+    // Whether every sample so far was black.
+    return !(mean_luminance > 0);
+  }
+
+  double display_error() const {
+    // Standard error of the mean luminance after the linear to gamma transform. Gamma is a
+    // square root, so an error of dL shows up as dL / (2 sqrt(L)) on screen. All black samples
+    // have no variance but say nothing about how rare the light reaching the pixel is, so their
+    // error is unknown rather than zero.
+    if (dark()) {
+      return infinity;
+    }
+    auto standard_error = sqrt(variance() / count);
+    return standard_error / (2 * sqrt(fmax(mean_luminance, 0.0)) + 1e-4);
+  }
+
+  static double luminance(const color &c) {
+    return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+  }
+
+ private:
+  int count;
+  color mean;
+  double mean_luminance;
+  double m2;
+};
+
+class framebuffer {
+  // Linear (not gamma corrected) RGB pixels stored as floats, row by row from the top left.
+ public:
+  framebuffer() : image_width(0), image_height(0) {}
+
+  framebuffer(int width, int height) {
+    resize(width, height);
+  }
+
+  void resize(int width, int height) {
+    image_width = width;
+    image_height = height;
+    pixels.assign(3 * static_cast<size_t>(width) * height, 0.0f);
+    sample_counts.assign(static_cast<size_t>(width) * height, 0);
+    variances.assign(static_cast<size_t>(width) * height, 0.0f);
+  }
+
+  int width() const {
+    return image_width;
+  }
+  int height() const {
+    return image_height;
+  }
+
+  color pixel(int x, int y) const {
+    auto p = &pixels[index(x, y)];
+    return color(p[0], p[1], p[2]);
+  }
+
+  void set_pixel(int x, int y, const color &c) {
+    auto p = &pixels[index(x, y)];
+    p[0] = static_cast<float>(c.x());
+    p[1] = static_cast<float>(c.y());
+    p[2] = static_cast<float>(c.z());
+  }
+
+  void set_pixel(int x, int y, const pixel_estimator &estimate) {
+    // Store the estimate's mean, along with how many samples it took and how noisy it was.
+    set_pixel(x, y, estimate.value());
+    auto i = static_cast<size_t>(y) * image_width + x;
+    sample_counts[i] = estimate.samples();
+    variances[i] = static_cast<float>(estimate.variance());
+  }
+
+  int sample_count(int x, int y) const {
+    return sample_counts[static_cast<size_t>(y) * image_width + x];
+  }
+
+  pixel_estimator estimate(int x, int y) const {
+    // The estimate stored for the pixel, to continue sampling it from.
+    return pixel_estimator(sample_count(x, y), pixel(x, y), variance(x, y));
+  }
+
+  long long total_samples() const {
+    long long total = 0;
+    for (auto count : sample_counts) {
+      total += count;
+    }
+    return total;
+  }
+
+  double variance(int x, int y) const {
+    return variances[static_cast<size_t>(y) * image_width + x];
+  }
+
+  const float *data() const {
+    // Interleaved RGB floats, width * height * 3 of them.
+    return pixels.data();
+  }
+
+ private:
+  int image_width, image_height;
+  std::vector<float> pixels;
+  std::vector<int> sample_counts;  // Samples taken per pixel.
+  std::vector<float> variances;    // Luminance variance per pixel.
+
+  size_t index(int x, int y) const {
+    return 3 * (static_cast<size_t>(y) * image_width + x);
+  }
+};
+
+#endif
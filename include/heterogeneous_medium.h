@@ -0,0 +1,244 @@
+#ifndef HETEROGENEOUS_MEDIUM_H
+#define HETEROGENEOUS_MEDIUM_H
+
+#include "common.h"
+
+#include "hittable.h"
+#include "material.h"
+#include "texture.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+class density_grid {
+  // Density sampled on a regular grid over a box and read back by trilinear interpolation,
+  // together with a coarse grid of majorants: each majorant cell covers a block of
+  // majorant_block^3 density cells and holds the largest density in that block. Interpolated
+  // densities never exceed their corner samples, so the majorants bound the field exactly.
+ public:
+  static const int majorant_block = 8;
+
+  template <typename Field>
+  density_grid(const aabb &box, int resolution, Field field) : bounds(box) {
+    // Sample field(p) over box, with resolution cells along its longest side and cells of the
+    // same size along the others. Every side of the box must have a positive length.
+    auto longest = std::max(box.x.size(), std::max(box.y.size(), box.z.size()));
+    for (int axis = 0; axis < 3; axis++) {
+      auto extent = box.axis(axis).size();
+      cells[axis] = std::max(1, static_cast<int>(std::ceil(resolution * extent / longest)));
+      scale[axis] = cells[axis] / extent;
+      blocks[axis] = (cells[axis] + majorant_block - 1) / majorant_block;
+    }
+
+    size_t row = cells[0] + 1, slice = row * (cells[1] + 1);
+    values.resize(slice * (cells[2] + 1));
+    {
+      thread_pool pool;
+      for (int k = 0; k <= cells[2]; k++) {
+        pool.submit([this, &field, &box, row, slice, k] {
+          auto *value = &values[k * slice];
+          for (int j = 0; j <= cells[1]; j++) {
+            for (int i = 0; i <= cells[0]; i++) {
+              point3 p(
+                  box.x.min + i / scale[0], box.y.min + j / scale[1], box.z.min + k / scale[2]);
+              value[j * row + i] = static_cast<float>(std::max(0.0, field(p)));
+            }
+          }
+        });
+      }
+      pool.wait();
+    }
+
+    // A block's majorant is the largest of the samples at the corners of its cells, which
+    // includes the samples on its far faces.
+    majorants.assign(static_cast<size_t>(blocks[0]) * blocks[1] * blocks[2], 0.0f);
+    for (int k = 0; k <= cells[2]; k++) {
+      for (int j = 0; j <= cells[1]; j++) {
+        for (int i = 0; i <= cells[0]; i++) {
+          auto value = values[k * slice + j * row + i];
+          for (int bk = block_below(k, 2); bk <= block_above(k, 2); bk++) {
+            for (int bj = block_below(j, 1); bj <= block_above(j, 1); bj++) {
+              for (int bi = block_below(i, 0); bi <= block_above(i, 0); bi++) {
+                auto &majorant = majorants[block_index(bi, bj, bk)];
+                majorant = std::max(majorant, value);
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+
+  const aabb &bounding_box() const {
+    return bounds;
+  }
+
+  void print(std::ostream &out) const {
+    out << "Volume: " << cells[0] + 1 << "x" << cells[1] + 1 << "x" << cells[2] + 1
+        << " density samples, " << blocks[0] << "x" << blocks[1] << "x" << blocks[2]
+        << " majorant cells\n";
+  }
+
+  real density(const point3 &p) const {
+    // The interpolated density at p, which must be inside the box.
+    int cell[3];
+    real f[3];
+    for (int axis = 0; axis < 3; axis++) {
+      auto x = (p[axis] - bounds.axis(axis).min) * scale[axis];
+      cell[axis] = std::min(std::max(static_cast<int>(x), 0), cells[axis] - 1);
+      f[axis] = std::min(std::max(x - cell[axis], real(0)), real(1));
+    }
+
+    size_t row = cells[0] + 1, slice = row * (cells[1] + 1);
+    const float *c = &values[cell[2] * slice + cell[1] * row + cell[0]];
+    auto lerp = [](real a, real b, real t) { return a + t * (b - a); };
+    auto near = lerp(lerp(c[0], c[1], f[0]), lerp(c[row], c[row + 1], f[0]), f[1]);
+    c += slice;
+    auto far = lerp(lerp(c[0], c[1], f[0]), lerp(c[row], c[row + 1], f[0]), f[1]);
+    return lerp(near, far, f[2]);
+  }
+
+  int majorant_cells(int axis) const {
+    return blocks[axis];
+  }
+
+  real majorant_scale(int axis) const {
+    // Majorant cells per unit length along an axis.
+    return scale[axis] / majorant_block;
+  }
+
+  real majorant(int i, int j, int k) const {
+    return majorants[block_index(i, j, k)];
+  }
+
+ private:
+  aabb bounds;
+  int cells[3];   // Density cells along each axis; there is one more sample than cells.
+  real scale[3];  // Density cells per unit length along each axis.
+  int blocks[3];  // Majorant cells along each axis.
+  std::vector<float> values;
+  std::vector<float> majorants;
+
+  int block_below(int sample, int axis) const {
+    // The block whose cells have sample as a corner, towards the lower side.
+    return std::min(std::max(sample - 1, 0) / majorant_block, blocks[axis] - 1);
+  }
+
+  int block_above(int sample, int axis) const {
+    return std::min(sample, cells[axis] - 1) / majorant_block;
+  }
+
+  size_t block_index(int i, int j, int k) const {
+    return (static_cast<size_t>(k) * blocks[1] + j) * blocks[0] + i;
+  }
+};
+
+class heterogeneous_medium : public hittable {
+  // A participating medium whose density varies through a box, given by a density_grid.
+  // Distances to the next scattering event are found by delta tracking: tentative collisions
+  // are drawn against the majorant of the cell the ray is in, and each is accepted as a real
+  // one with probability density / majorant. The ray walks the majorant grid cell by cell
+  // (Amanatides and Woo's DDA), so empty cells are crossed without drawing anything and thin
+  // ones with few rejected collisions.
+ public:
+  heterogeneous_medium(shared_ptr<density_grid> grid, shared_ptr<texture> albedo)
+      : grid(grid), phase_function(make_shared<isotropic>(albedo)) {}
+
+  bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
+    HEMERA_COUNT(stat_volume_tests);
+    const auto &box = grid->bounding_box();
+    const auto &origin = r.origin();
+    const auto &direction = r.direction();
+
+    // Clip the ray to the box, as in aabb::hit.
+    interval inside = ray_t;
+    for (int axis = 0; axis < 3; axis++) {
+      auto inv_d = 1 / direction[axis];
+      auto t0 = (box.axis(axis).min - origin[axis]) * inv_d;
+      auto t1 = (box.axis(axis).max - origin[axis]) * inv_d;
+      if (inv_d < 0) {
+        std::swap(t0, t1);
+      }
+      inside.min = fmax(inside.min, t0);
+      inside.max = fmin(inside.max, t1);
+    }
+    if (inside.min >= inside.max) {
+      return false;
+    }
+
+    // Set up the walk through the majorant grid from the point where the ray enters it.
+    int cell[3], step[3], cells[3];
+    real t_next[3], t_delta[3];
+    for (int axis = 0; axis < 3; axis++) {
+      cells[axis] = grid->majorant_cells(axis);
+      auto scale = grid->majorant_scale(axis);
+      auto position = (origin[axis] + inside.min * direction[axis] - box.axis(axis).min) * scale;
+      cell[axis] = std::min(std::max(static_cast<int>(position), 0), cells[axis] - 1);
+      if (direction[axis] == 0) {
+        step[axis] = 0;
+        t_next[axis] = t_delta[axis] = infinity;
+        continue;
+      }
+      step[axis] = direction[axis] > 0 ? 1 : -1;
+      t_delta[axis] = 1 / (fabs(direction[axis]) * scale);
+      auto boundary = cell[axis] + (step[axis] > 0 ? 1 : 0);
+      t_next[axis] = inside.min + (boundary - position) / (direction[axis] * scale);
+    }
+
+    auto speed = direction.length();
+    auto t = inside.min;
+    while (t < inside.max) {
+      int axis = t_next[0] < t_next[1] ? (t_next[0] < t_next[2] ? 0 : 2)
+                                       : (t_next[1] < t_next[2] ? 1 : 2);
+      auto cell_end = fmin(t_next[axis], inside.max);
+
+      auto majorant = grid->majorant(cell[0], cell[1], cell[2]);
+      if (majorant > 0) {
+        // The free path against the majorant is exponential, and memoryless, so a collision
+        // drawn past the end of the cell is simply dropped and drawn again in the next one.
+        for (;;) {
+          t -= log(1 - random_double()) / (majorant * speed);
+          if (t >= cell_end) {
+            break;
+          }
+          HEMERA_COUNT(stat_volume_collisions);
+          if (random_double() * majorant < grid->density(r.at(t))) {
+            rec.t = t;
+            rec.u = rec.v = 0;
+            rec.object = this;
+            HEMERA_COUNT(stat_volume_scatters);
+            return true;
+          }
+        }
+      }
+
+      t = cell_end;
+      cell[axis] += step[axis];
+      if (cell[axis] < 0 || cell[axis] >= cells[axis]) {
+        return false;
+      }
+      t_next[axis] += t_delta[axis];
+    }
+    return false;
+  }
+
+  void finalize(const ray &r, hit_record &rec) const override {
+    rec.p = r.at(rec.t);
+    rec.normal = vec3(1, 0, 0);  // Arbitrary
+    rec.front_face = true;       // Also arbitrary
+    rec.mat = phase_function.get();
+    rec.uv_density = 0;
+  }
+
+  aabb bounding_box() const override {
+    return grid->bounding_box();
+  }
+
+ private:
+  shared_ptr<density_grid> grid;
+  shared_ptr<material> phase_function;
+};
+
+#endif
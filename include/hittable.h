@@ -3,19 +3,45 @@
 
 #include "aabb.h"
 #include "ray.h"
+#include "ray_packet.h"
+#include "render_stats.h"
+
+#include <utility>
+#include <vector>
 
 // Forward declaration to avoid circular reference issue
 class material;
+class hittable;
 
 class hit_record {
+  // A hit is recorded in two steps. During traversal hit() only sets t, the object that was
+  // hit and the object's own description of where (a primitive index and parametric u, v),
+  // since most candidates are replaced by a closer one. Once the closest hit is known,
+  // finalize() fills in the rest, so the surface is evaluated once per ray.
+  //
+  // The material is a plain pointer to the one owned by the object that was hit, so recording
+  // a hit and copying records never touches a shared reference count.
  public:
+  // The fields are ordered to leave no padding: 64 bytes in the float build, 104 in double.
+  const hittable *object;
+  real t;
+  real u;
+  real v;
+  int primitive;
+
+  // Set by finalize().
+  bool front_face;
   point3 p;
   vec3 normal;
-  shared_ptr<material> mat;
-  double t;
-  double u;
-  double v;
-  bool front_face;
+  float uv_density;  // Texture coordinate units per unit of length on the surface; 0 if none.
+  union {
+    const material *mat;
+    // Until finalize(), when object is an instance: what the instance's object hit. It can
+    // share the material's slot because only finalize() ever sets the material.
+    const hittable *inner_object;
+  };
+
+  void finalize(const ray &r);
 
   // We're going to assume the normal opposes the incoming ray.
   void set_face_normal(const ray &r, const vec3 &outward_normal) {
@@ -27,121 +53,95 @@ class hit_record {
   }
 };
 
+#if defined(HEMERA_FLOAT) && !defined(HEMERA_SIMD_VEC3)
+// Every candidate hit is written to a record, so keep it to one cache line.
+static_assert(sizeof(hit_record) <= 64, "hit_record no longer fits a cache line");
+#endif
+
 class hittable {
  public:
   virtual ~hittable() = default;
 
+  // Return true if the ray hits inside ray_t, and record the hit in rec's t, object, primitive,
+  // u and v. rec is left untouched on a miss, so a caller can keep passing the record of its
+  // closest hit so far. The record is complete only after rec.finalize(r).
   virtual bool hit(const ray &r, interval ray_t, hit_record &rec) const = 0;
 
-  virtual aabb bounding_box() const = 0;
-};
+  virtual void finalize(const ray &, hit_record &) const {
+    // Fill in the point, normal, material and texture coordinates of a hit recorded by this
+    // object. Every object that can be left as a record's object sets the material here and
+    // not in hit(), since an instance keeps its own state in that slot until then.
+  }
 
-class translate : public hittable {
- public:
-  translate(shared_ptr<hittable> p, const vec3 &displacement) : object(p), offset(displacement) {
-    bbox = object->bounding_box() + offset;
+  virtual int hit_packet(const ray_packet &packet,
+                         real t_min,
+                         real t_max[],
+                         hit_record rec[],
+                         int active) const {
+    // Intersect the active lanes of a packet, each against its own [t_min, t_max[lane]]
+    // interval. Lanes that hit get their record filled and t_max shrunk to the hit, and are
+    // returned as a bit mask. This fallback traces the lanes one at a time.
+    int hits = 0;
+    for (int lane = 0; lane < ray_packet::size; lane++) {
+      if (!(active & (1 << lane))) {
+        continue;
+      }
+      if (packet.rng) {
+        std::swap(thread_rng(), packet.rng[lane]);
+      }
+      if (hit(packet.rays[lane], interval(t_min, t_max[lane]), rec[lane])) {
+        hits |= 1 << lane;
+        t_max[lane] = rec[lane].t;
+      }
+      if (packet.rng) {
+        std::swap(thread_rng(), packet.rng[lane]);
+      }
+    }
+    return hits;
   }
 
-  bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
-    // Move the ray backwards by the offset
-    ray offset_r(r.origin() - offset, r.direction(), r.time());
+  virtual aabb bounding_box() const = 0;
 
-    // Determine where (if any) an intersection occurs along the offset ray
-    if (!object->hit(offset_r, ray_t, rec)) {
+  virtual bool hit_interval(const ray &r, interval &inside) const {
+    // For a closed, convex object: the t interval over which the ray's line is inside it, with
+    // t possibly negative. Returns false if the line misses it. This fallback finds the entry
+    // and exit with two hit() calls; shapes with a closed form override it.
+    hit_record entry, exit;
+    if (!hit(r, interval::universe, entry) ||
+        !hit(r, interval(entry.t + 0.0001, infinity), exit))
+    {
       return false;
     }
-
-    // Move the intersection point forwards by the offset
-    rec.p += offset;
-
+    inside = interval(entry.t, exit.t);
     return true;
   }
 
-  aabb bounding_box() const override {
-    return bbox;
+  // Light sampling. An object that can be sampled as a light picks directions from an origin
+  // towards random points on itself with random(), and pdf_value() gives the solid angle
+  // density of that choice (zero for directions that miss the object).
+  virtual double pdf_value(const point3 &, const vec3 &) const {
+    return 0;
   }
 
- private:
-  shared_ptr<hittable> object;
-  vec3 offset;
-  aabb bbox;
-};
-
-class rotate_y : public hittable {
- public:
-  rotate_y(shared_ptr<hittable> p, double angle) : object(p) {
-    auto radians = degrees_to_radians(angle);
-    sin_theta = sin(radians);
-    cos_theta = cos(radians);
-    bbox = object->bounding_box();
-
-    point3 min(infinity, infinity, infinity);
-    point3 max(-infinity, -infinity, -infinity);
-
-    for (int i = 0; i < 2; i++) {
-      for (int j = 0; j < 2; j++) {
-        for (int k = 0; k < 2; k++) {
-          auto x = i * bbox.x.max + (1 - i) * bbox.x.min;
-          auto y = j * bbox.y.max + (1 - j) * bbox.y.min;
-          auto z = k * bbox.z.max + (1 - k) * bbox.z.min;
-
-          auto newx = cos_theta * x + sin_theta * z;
-          auto newz = -sin_theta * x + cos_theta * z;
-
-          vec3 tester(newx, y, newz);
-
-          for (int c = 0; c < 3; c++) {
-            min[c] = fmin(min[c], tester[c]);
-            max[c] = fmax(max[c], tester[c]);
-          }
-        }
-      }
-    }
+  virtual vec3 random(const point3 &) const {
+    return vec3(1, 0, 0);
   }
 
-  bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
-    // Change the ray from world space to object space.
-    auto origin = r.origin();
-    auto direction = r.direction();
-
-    origin[0] = cos_theta * r.origin()[0] - sin_theta * r.origin()[2];
-    origin[2] = sin_theta * r.origin()[0] + cos_theta * r.origin()[2];
-
-    direction[0] = cos_theta * r.direction()[0] - sin_theta * r.direction()[2];
-    direction[2] = sin_theta * r.direction()[0] + cos_theta * r.direction()[2];
-
-    ray rotated_r(origin, direction, r.time());
-
-    // Determine where (if any) an intersection occurs in object space.
-    if (!object->hit(rotated_r, ray_t, rec)) {
-      return false;
-    }
-
-    // Change the intersection point from object space tp world space.
-    auto p = rec.p;
-    p[0] = cos_theta * rec.p[0] - sin_theta * rec.p[2];
-    p[2] = sin_theta * rec.p[0] + cos_theta * rec.p[2];
-
-    // Change the normal from object space to world space
-    auto normal = rec.normal;
-    normal[0] = cos_theta * rec.normal[0] + sin_theta * rec.normal[2];
-    normal[2] = -sin_theta * rec.normal[0] + cos_theta * rec.normal[2];
-
-    rec.p = p;
-    rec.normal = normal;
-
-    return true;
+  virtual void gather_lights(std::vector<const hittable *> &) const {
+    // Append the emissive objects that support light sampling to the list. Aggregates forward
+    // this to their children; objects that can't be sampled are left out and are only found
+    // when a path hits them.
   }
 
-  aabb bounding_box() const override {
-    return bbox;
+  virtual bool records_instances() const {
+    // Whether hit() can leave an instance as the record's object. Aggregates forward this to
+    // their children.
+    return false;
   }
-
- private:
-  shared_ptr<hittable> object;
-  double sin_theta;
-  double cos_theta;
-  aabb bbox;
 };
 
+inline void hit_record::finalize(const ray &r) {
+  object->finalize(r, *this);
+}
+
 #endif
\ No newline at end of file
@@ -29,21 +29,46 @@ class hittable_list : public hittable {
   }
 
   bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
-    hit_record temp_rec;
     bool hit_anything = false;
     auto closest_so_far = ray_t.max;
 
     for (const auto &object : objects) {
-      if (object->hit(r, interval(ray_t.min, closest_so_far), temp_rec)) {
+      if (object->hit(r, interval(ray_t.min, closest_so_far), rec)) {
         hit_anything = true;
-        closest_so_far = temp_rec.t;
-        rec = temp_rec;
+        closest_so_far = rec.t;
       }
     }
 
     return hit_anything;
   }
 
+  int hit_packet(const ray_packet &packet,
+                 real t_min,
+                 real t_max[],
+                 hit_record rec[],
+                 int active) const override {
+    int hits = 0;
+    for (const auto &object : objects) {
+      hits |= object->hit_packet(packet, t_min, t_max, rec, active);
+    }
+    return hits;
+  }
+
+  void gather_lights(std::vector<const hittable *> &lights) const override {
+    for (const auto &object : objects) {
+      object->gather_lights(lights);
+    }
+  }
+
+  bool records_instances() const override {
+    for (const auto &object : objects) {
+      if (object->records_instances()) {
+        return true;
+      }
+    }
+    return false;
+  }
+
   aabb bounding_box() const override {
     return bbox;
   }
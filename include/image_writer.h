@@ -0,0 +1,232 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include "common.h"
+
+#include "color.h"
+#include "framebuffer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Each writer encodes the whole framebuffer into memory and hands it to the output stream in a
+// single write. The 8-bit formats (P6, PNG) are gamma corrected, the float formats (PFM, HDR)
+// keep the linear radiance values.
+
+inline void encode_ppm(const framebuffer &image, std::vector<unsigned char> &out) {
+  // Binary (P6) PPM.
+  std::string header = "P6\n" + std::to_string(image.width()) + ' ' +
+                       std::to_string(image.height()) + "\n255\n";
+  out.assign(header.begin(), header.end());
+
+  auto pixel_count = static_cast<size_t>(image.width()) * image.height();
+  out.reserve(out.size() + 3 * pixel_count);
+  const float *pixels = image.data();
+  for (size_t i = 0; i < 3 * pixel_count; i++) {
+    out.push_back(linear_to_byte(pixels[i]));
+  }
+}
+
+inline void encode_pfm(const framebuffer &image, std::vector<unsigned char> &out) {
+  // Portable float map: three little endian floats per pixel, bottom row first.
+  std::string header = "PF\n" + std::to_string(image.width()) + ' ' +
+                       std::to_string(image.height()) + "\n-1.0\n";
+  out.assign(header.begin(), header.end());
+
+  auto row_bytes = 3 * sizeof(float) * image.width();
+  auto offset = out.size();
+  out.resize(offset + row_bytes * image.height());
+  for (int y = image.height() - 1; y >= 0; y--) {
+    auto row = image.data() + 3 * static_cast<size_t>(y) * image.width();
+    std::memcpy(&out[offset], row, row_bytes);
+    offset += row_bytes;
+  }
+}
+
+inline void encode_hdr(const framebuffer &image, std::vector<unsigned char> &out) {
+  // Radiance RGBE, using the run-length scanline layout with literal runs only.
+  std::string header = "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y " +
+                       std::to_string(image.height()) + " +X " + std::to_string(image.width()) +
+                       "\n";
+  out.assign(header.begin(), header.end());
+
+  int width = image.width();
+  std::vector<unsigned char> rgbe(4 * width);
+
+  for (int y = 0; y < image.height(); y++) {
+    for (int x = 0; x < width; x++) {
+      auto c = image.pixel(x, y);
+      auto brightest = fmax(c.x(), fmax(c.y(), c.z()));
+      unsigned char *e = &rgbe[4 * x];
+      if (brightest < 1e-32) {
+        e[0] = e[1] = e[2] = e[3] = 0;
+        continue;
+      }
+      int exponent;
+      auto scale = frexp(brightest, &exponent) * 256.0 / brightest;
+      e[0] = static_cast<unsigned char>(c.x() * scale);
+      e[1] = static_cast<unsigned char>(c.y() * scale);
+      e[2] = static_cast<unsigned char>(c.z() * scale);
+      e[3] = static_cast<unsigned char>(exponent + 128);
+    }
+
+    // Widths outside [8, 32767] cannot be run-length encoded and are written flat.
+    if (width < 8 || width > 32767) {
+      out.insert(out.end(), rgbe.begin(), rgbe.end());
+      continue;
+    }
+
+    out.push_back(2);
+    out.push_back(2);
+    out.push_back(static_cast<unsigned char>(width >> 8));
+    out.push_back(static_cast<unsigned char>(width & 0xff));
+    for (int channel = 0; channel < 4; channel++) {
+      for (int x = 0; x < width; x += 128) {
+        int count = std::min(128, width - x);
+        out.push_back(static_cast<unsigned char>(count));
+        for (int k = 0; k < count; k++) {
+          out.push_back(rgbe[4 * (x + k) + channel]);
+        }
+      }
+    }
+  }
+}
+
+inline uint32_t png_crc(const unsigned char *data, size_t length, uint32_t crc = 0) {
+  static uint32_t table[256];
+  static bool table_ready = false;
+  if (!table_ready) {
+    for (uint32_t n = 0; n < 256; n++) {
+      uint32_t c = n;
+      for (int k = 0; k < 8; k++) {
+        c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      }
+      table[n] = c;
+    }
+    table_ready = true;
+  }
+
+  crc = ~crc;
+  for (size_t i = 0; i < length; i++) {
+    crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+inline void png_put_u32(std::vector<unsigned char> &out, uint32_t value) {
+  out.push_back(static_cast<unsigned char>(value >> 24));
+  out.push_back(static_cast<unsigned char>(value >> 16));
+  out.push_back(static_cast<unsigned char>(value >> 8));
+  out.push_back(static_cast<unsigned char>(value));
+}
+
+inline void png_put_chunk(std::vector<unsigned char> &out,
+                          const char *type,
+                          const std::vector<unsigned char> &payload) {
+  png_put_u32(out, static_cast<uint32_t>(payload.size()));
+  auto type_offset = out.size();
+  out.insert(out.end(), type, type + 4);
+  out.insert(out.end(), payload.begin(), payload.end());
+  png_put_u32(out, png_crc(&out[type_offset], 4 + payload.size()));
+}
+
+inline void encode_png(const framebuffer &image, std::vector<unsigned char> &out) {
+  // 8-bit RGB PNG. The pixel data is wrapped in stored (uncompressed) deflate blocks, which
+  // keeps the encoder dependency free at the cost of a larger file.
+  static const unsigned char signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+  out.assign(signature, signature + sizeof(signature));
+
+  std::vector<unsigned char> header;
+  png_put_u32(header, image.width());
+  png_put_u32(header, image.height());
+  header.push_back(8);  // Bit depth
+  header.push_back(2);  // Color type: RGB
+  header.push_back(0);  // Compression method
+  header.push_back(0);  // Filter method
+  header.push_back(0);  // Interlace method
+  png_put_chunk(out, "IHDR", header);
+
+  // Scanlines, each preceded by filter type 0 (none).
+  std::vector<unsigned char> raw;
+  raw.reserve((3 * static_cast<size_t>(image.width()) + 1) * image.height());
+  for (int y = 0; y < image.height(); y++) {
+    raw.push_back(0);
+    auto row = image.data() + 3 * static_cast<size_t>(y) * image.width();
+    for (int i = 0; i < 3 * image.width(); i++) {
+      raw.push_back(linear_to_byte(row[i]));
+    }
+  }
+
+  std::vector<unsigned char> zlib;
+  zlib.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+  zlib.push_back(0x78);
+  zlib.push_back(0x01);
+  size_t offset = 0;
+  do {
+    auto block = std::min<size_t>(65535, raw.size() - offset);
+    bool last = offset + block == raw.size();
+    zlib.push_back(last ? 1 : 0);
+    zlib.push_back(static_cast<unsigned char>(block & 0xff));
+    zlib.push_back(static_cast<unsigned char>(block >> 8));
+    zlib.push_back(static_cast<unsigned char>(~block & 0xff));
+    zlib.push_back(static_cast<unsigned char>((~block >> 8) & 0xff));
+    zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + block);
+    offset += block;
+  } while (offset < raw.size());
+
+  // Adler-32 checksum of the uncompressed data.
+  uint32_t a = 1, b = 0;
+  for (auto byte : raw) {
+    a = (a + byte) % 65521;
+    b = (b + a) % 65521;
+  }
+  png_put_u32(zlib, (b << 16) | a);
+  png_put_chunk(out, "IDAT", zlib);
+
+  png_put_chunk(out, "IEND", std::vector<unsigned char>());
+}
+
+inline bool write_image(const std::string &path, const framebuffer &image) {
+  // Write the framebuffer to the given path, choosing the format from the file extension
+  // (.png, .ppm, .pfm or .hdr). A path of "-" writes a binary PPM to standard output.
+  std::vector<unsigned char> bytes;
+
+  if (path == "-" || has_extension(path, ".ppm")) {
+    encode_ppm(image, bytes);
+  }
+  else if (has_extension(path, ".png")) {
+    encode_png(image, bytes);
+  }
+  else if (has_extension(path, ".pfm")) {
+    encode_pfm(image, bytes);
+  }
+  else if (has_extension(path, ".hdr")) {
+    encode_hdr(image, bytes);
+  }
+  else {
+    std::cerr << "ERROR: Unknown image format for '" << path << "'.\n";
+    return false;
+  }
+
+  if (path == "-") {
+    std::cout.write(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+    std::cout.flush();
+    return static_cast<bool>(std::cout);
+  }
+
+  std::ofstream file(path, std::ios::binary);
+  file.write(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+  if (!file) {
+    std::cerr << "ERROR: Couldn't write image file '" << path << "'.\n";
+    return false;
+  }
+  return true;
+}
+
+#endif
@@ -0,0 +1,141 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "common.h"
+
+#include "hittable.h"
+#include "transform.h"
+
+class instance : public hittable {
+  // A placement of shared geometry: the object (often a bvh_node or a triangle_mesh) is
+  // stored once and every instance refers to it through its own affine transform and,
+  // optionally, its own material. Rays are taken into object space instead of moving the
+  // geometry, so a scene's memory grows with its unique geometry, and a top level bvh_node
+  // over the instances gives a two level hierarchy.
+ public:
+  instance(shared_ptr<hittable> p, const affine_transform &transform)
+      : instance(p, transform, nullptr) {}
+
+  instance(shared_ptr<hittable> p,
+           const affine_transform &transform,
+           shared_ptr<material> material_override)
+      : object(p), object_to_world(transform), mat(material_override) {
+    // An instance of an instance folds into one transform, so nested placements cost a
+    // single ray transformation. The outer material override wins.
+    auto inner = std::dynamic_pointer_cast<instance>(object);
+    if (inner) {
+      object = inner->object;
+      object_to_world = object_to_world * inner->object_to_world;
+      mat = mat ? mat : inner->mat;
+    }
+    world_to_object = object_to_world.inverse();
+    nested = object->records_instances();
+    length_scale = std::cbrt(std::fabs(object_to_world.determinant()));
+    bbox = object_to_world.box(object->bounding_box());
+  }
+
+  bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
+    // The object space direction is not normalized, so t is the same in both spaces.
+    if (!object->hit(object_ray(r), ray_t, rec)) {
+      return false;
+    }
+    record(r, rec);
+    return true;
+  }
+
+  int hit_packet(const ray_packet &packet,
+                 real t_min,
+                 real t_max[],
+                 hit_record rec[],
+                 int active) const override {
+    // Move the whole packet into object space, so the object can still trace it as one.
+    ray_packet object_packet;
+    object_packet.rng = packet.rng;
+    for (int k = 0; k < ray_packet::size; k++) {
+      if (active & (1 << k)) {
+        object_packet.set(k, object_ray(packet.rays[k]));
+      }
+    }
+
+    int hits = object->hit_packet(object_packet, t_min, t_max, rec, active);
+    for (int k = 0; k < ray_packet::size; k++) {
+      if (hits & (1 << k)) {
+        record(packet.rays[k], rec[k]);
+      }
+    }
+    return hits;
+  }
+
+  aabb bounding_box() const override {
+    return bbox;
+  }
+
+  bool hit_interval(const ray &r, interval &inside) const override {
+    return object->hit_interval(object_ray(r), inside);
+  }
+
+  void finalize(const ray &r, hit_record &rec) const override {
+    if (!nested) {
+      rec.object = rec.inner_object;
+      to_world(r, rec);
+    }
+  }
+
+  bool records_instances() const override {
+    return true;
+  }
+
+ private:
+  shared_ptr<hittable> object;
+  affine_transform object_to_world;
+  affine_transform world_to_object;
+  shared_ptr<material> mat;  // Replaces the object's materials when set.
+  real length_scale;         // Average stretch of lengths from object to world space.
+  bool nested;               // Whether the object holds instances of its own.
+  aabb bbox;
+
+  ray object_ray(const ray &r) const {
+    return ray(world_to_object.point(r.origin()), world_to_object.vector(r.direction()), r.time());
+  }
+
+  void record(const ray &r, hit_record &rec) const {
+    // Keep the object's hit for finalize(), with the instance as the record's object and the
+    // object that was hit in inner_object. The record has room for one such level, so when the
+    // object holds instances of its own (e.g. a list of placed boxes, itself instanced) the hit
+    // is finalized here instead; the inner instances still defer theirs.
+    if (nested) {
+      to_world(r, rec);
+      return;
+    }
+    rec.inner_object = rec.object;
+    rec.object = this;
+  }
+
+  void to_world(const ray &r, hit_record &rec) const {
+    // Finalize the object's hit in object space, where its ray is rebuilt from r, and move the
+    // result to world space. Normals transform with the inverse transpose. That keeps their dot
+    // product with the ray direction, so the record's front_face still holds.
+    rec.finalize(object_ray(r));
+    rec.object = this;
+    rec.p = r.at(rec.t);
+    rec.normal = unit_vector(world_to_object.transposed_vector(rec.normal));
+    rec.uv_density /= length_scale;
+    if (mat) {
+      rec.mat = mat.get();
+    }
+  }
+};
+
+class translate : public instance {
+ public:
+  translate(shared_ptr<hittable> p, const vec3 &displacement)
+      : instance(p, affine_transform::translation(displacement)) {}
+};
+
+class rotate_y : public instance {
+ public:
+  rotate_y(shared_ptr<hittable> p, double angle)
+      : instance(p, affine_transform::rotation(vec3(0, 1, 0), angle)) {}
+};
+
+#endif
@@ -1,35 +1,41 @@
 #ifndef INTERVAL_H
 #define INTERVAL_H
 
-class interval {
+template <typename T>
+class basic_interval {
  public:
-  double min, max;
+  using scalar = T;
 
-  interval() : min(+infinity), max(-infinity) {}
+  T min, max;
 
-  interval(double _min, double _max) : min(_min), max(_max) {}
+  // constexpr so the empty and universe constants are initialized before any other static,
+  // in particular before aabb's, which are built from them.
+  constexpr basic_interval()
+      : min(+std::numeric_limits<T>::infinity()), max(-std::numeric_limits<T>::infinity()) {}
 
-  interval(const interval &a, const interval &b)
-      : min(fmin(a.min, b.min)), max(fmax(a.max, b.max)) {}
+  constexpr basic_interval(T _min, T _max) : min(_min), max(_max) {}
 
-  double size() const {
+  basic_interval(const basic_interval &a, const basic_interval &b)
+      : min(std::fmin(a.min, b.min)), max(std::fmax(a.max, b.max)) {}
+
+  T size() const {
     return max - min;
   }
 
-  interval expand(double delta) const {
+  basic_interval expand(T delta) const {
     auto padding = delta / 2;
-    return interval(min - padding, max + padding);
+    return basic_interval(min - padding, max + padding);
   }
 
-  bool contains(double x) const {
+  bool contains(T x) const {
     return min <= x && x <= max;
   }
 
-  bool surrounds(double x) const {
+  bool surrounds(T x) const {
     return min < x && x < max;
   }
 
-  double clamp(double x) const {
+  T clamp(T x) const {
     if (x < min) {
       return min;
     }
@@ -39,18 +45,28 @@ class interval {
     return x;
   }
 
-  static const interval empty, universe;
+  static const basic_interval empty, universe;
 };
 
-const interval interval::empty = interval(+infinity, -infinity);
-const interval interval::universe = interval(-infinity, +infinity);
+template <typename T>
+const basic_interval<T> basic_interval<T>::empty =
+    basic_interval<T>(+std::numeric_limits<T>::infinity(), -std::numeric_limits<T>::infinity());
+template <typename T>
+const basic_interval<T> basic_interval<T>::universe =
+    basic_interval<T>(-std::numeric_limits<T>::infinity(), +std::numeric_limits<T>::infinity());
+
+using interval = basic_interval<real>;
 
-interval operator+(const interval &ival, double displacement) {
-  return interval(ival.min + displacement, ival.max + displacement);
+template <typename T>
+basic_interval<T> operator+(const basic_interval<T> &ival,
+                            typename basic_interval<T>::scalar displacement) {
+  return basic_interval<T>(ival.min + displacement, ival.max + displacement);
 }
 
-interval operator+(double displacement, const interval &ival) {
+template <typename T>
+basic_interval<T> operator+(typename basic_interval<T>::scalar displacement,
+                            const basic_interval<T> &ival) {
   return ival + displacement;
 }
 
-#endif
\ No newline at end of file
+#endif
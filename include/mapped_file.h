@@ -0,0 +1,68 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+class mapped_file {
+  // A whole file mapped read-only into memory. The pages are shared with the page cache, so
+  // processes mapping the same file share one copy, and only the pages that are touched are
+  // read from disk.
+ public:
+  mapped_file() : bytes(nullptr), length(0) {}
+  mapped_file(const mapped_file &) = delete;
+  mapped_file &operator=(const mapped_file &) = delete;
+
+  ~mapped_file() {
+    close();
+  }
+
+  bool open(const std::string &path) {
+    // Map the file, replacing any earlier mapping. Returns false if it can't be mapped.
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+      length = static_cast<size_t>(info.st_size);
+      void *address = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+      bytes = address == MAP_FAILED ? nullptr : static_cast<const unsigned char *>(address);
+    }
+    ::close(fd);
+
+    if (!bytes) {
+      length = 0;
+    }
+    return bytes != nullptr;
+  }
+
+  void close() {
+    if (bytes) {
+      munmap(const_cast<unsigned char *>(bytes), length);
+    }
+    bytes = nullptr;
+    length = 0;
+  }
+
+  const unsigned char *data() const {
+    return bytes;
+  }
+
+  size_t size() const {
+    return length;
+  }
+
+ private:
+  const unsigned char *bytes;
+  size_t length;
+};
+
+#endif
@@ -15,10 +15,27 @@ class material {
     return color(0, 0, 0);
   }
 
+  virtual bool is_emissive() const {
+    // Whether emitted() can be non-zero, so objects made of this material act as lights.
+    return false;
+  }
+
+  // Choose the ray scattered from rec and its attenuation, or return false if the ray is
+  // absorbed. footprint is the width of the ray's footprint on the surface in texture
+  // coordinates, for filtered texture lookups; 0 means no filtering.
   virtual bool scatter(const ray &r_in,
                        const hit_record &rec,
+                       double footprint,
                        color &attenuation,
                        ray &scattered) const = 0;
+
+  virtual double scattering_pdf(const ray &, const hit_record &, const ray &) const {
+    // Solid angle density with which scatter() picks the direction of the scattered ray. The
+    // attenuation times this density is the BSDF times the cosine term, which lets light
+    // sampling evaluate directions that scatter() didn't choose. Specular materials, whose
+    // directions can't be reached by sampling a light, return zero.
+    return 0;
+  }
 };
 
 class lambertian : public material {
@@ -28,8 +45,10 @@ class lambertian : public material {
 
   bool scatter(const ray &r_in,
                const hit_record &rec,
+               double footprint,
                color &attenuation,
                ray &scattered) const override {
+    HEMERA_COUNT(stat_lambertian_scatters);
     auto scatter_direction = rec.normal + random_unit_vector();
 
     // Catch degenerate scatter direction.
@@ -40,10 +59,16 @@ class lambertian : public material {
     }
 
     scattered = ray(rec.p, scatter_direction, r_in.time());
-    attenuation = albedo->value(rec.u, rec.v, rec.p);
+    attenuation = albedo->filtered_value(rec.u, rec.v, rec.p, footprint);
     return true;
   }
 
+  double scattering_pdf(const ray &, const hit_record &rec, const ray &scattered) const override {
+    // Cosine weighted hemisphere.
+    auto cos_theta = dot(rec.normal, unit_vector(scattered.direction()));
+    return cos_theta < 0 ? 0 : cos_theta / pi;
+  }
+
  private:
   shared_ptr<texture> albedo;
 };
@@ -54,8 +79,10 @@ class metal : public material {
 
   bool scatter(const ray &r_in,
                const hit_record &rec,
+               double,
                color &attenuation,
                ray &scattered) const override {
+    HEMERA_COUNT(stat_metal_scatters);
     vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
     scattered = ray(rec.p, reflected + fuzz * random_unit_vector(), r_in.time());
     attenuation = albedo;
@@ -73,8 +100,10 @@ class dielectric : public material {
 
   bool scatter(const ray &r_in,
                const hit_record &rec,
+               double,
                color &attenuation,
                ray &scatter) const override {
+    HEMERA_COUNT(stat_dielectric_scatters);
     attenuation = color(1.0, 1.0, 1.0);
     double refraction_ratio = rec.front_face ? (1.0 / ir) : ir;
 
@@ -114,6 +143,7 @@ class diffuse_light : public material {
 
   bool scatter(const ray &r_in,
                const hit_record &rec,
+               double,
                color &attenuation,
                ray &scattered) const override {
     return false;
@@ -123,6 +153,10 @@ class diffuse_light : public material {
     return emit->value(u, v, p);
   }
 
+  bool is_emissive() const override {
+    return true;
+  }
+
  private:
   shared_ptr<texture> emit;
 };
@@ -134,13 +168,20 @@ class isotropic : public material {
 
   bool scatter(const ray &r_in,
                const hit_record &rec,
+               double footprint,
                color &attenuation,
                ray &scattered) const override {
+    HEMERA_COUNT(stat_isotropic_scatters);
     scattered = ray(rec.p, random_unit_vector(), r_in.time());
-    attenuation = albedo->value(rec.u, rec.v, rec.p);
+    attenuation = albedo->filtered_value(rec.u, rec.v, rec.p, footprint);
     return true;
   }
 
+  double scattering_pdf(const ray &, const hit_record &, const ray &) const override {
+    // Uniform over the sphere of directions.
+    return 1 / (4 * pi);
+  }
+
  private:
   shared_ptr<texture> albedo;
 };
@@ -0,0 +1,300 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include "common.h"
+
+#include "bvh.h"
+#include "mapped_file.h"
+#include "mesh_loader.h"
+#include "triangle_mesh.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Binary cache of built triangle meshes. Loading a large mesh means parsing its file and
+// building its BVH, which takes seconds. The cache stores the result (vertex arrays, leaf
+// ordered triangles and wide BVH nodes) in one file, which later runs map read-only and render
+// from in place, without parsing, copying or building anything.
+//
+// A cache file is named after a key that hashes the mesh file's contents together with all
+// that decides the layout of the data: the format version, the scalar and vector types, the
+// width of the BVH nodes and the build options. An edited mesh or a differently configured
+// build never picks up a stale file. Files are written under a temporary name and renamed
+// into place, so renders running at the same time can share a cache directory.
+
+const uint32_t mesh_cache_version = 1;
+
+enum mesh_cache_section {
+  cache_positions,
+  cache_normals,
+  cache_uvs,
+  cache_indices,
+  cache_face_normals,
+  cache_nodes,
+  cache_section_count
+};
+
+struct mesh_cache_header {
+  char magic[8];  // "HEMERAMC"
+  uint32_t version;
+  uint32_t has_normals;
+  uint32_t has_uvs;
+  uint32_t reserved;
+  uint64_t key;
+  uint64_t vertex_count;
+  uint64_t triangle_count;
+  uint64_t node_count;
+  aabb bounds;
+  bvh_build_stats stats;
+  uint64_t offset[cache_section_count];  // Where each array starts, 64 byte aligned.
+};
+
+static_assert(std::is_trivially_copyable<mesh_cache_header>::value &&
+                  std::is_trivially_copyable<vec3>::value &&
+                  std::is_trivially_copyable<wide_bvh_node>::value,
+              "the mesh cache stores these types as raw bytes");
+
+inline uint64_t fnv1a(const void *data, size_t size, uint64_t hash = 14695981039346656037ull) {
+  // 64 bit FNV-1a of the bytes, continuing from hash.
+  const auto *bytes = static_cast<const unsigned char *>(data);
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ bytes[i]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+inline uint64_t mesh_cache_key(const mapped_file &source, const bvh_build_options &options) {
+  uint64_t layout[] = {mesh_cache_version,
+                       sizeof(real),
+                       sizeof(vec3),
+                       alignof(vec3),
+                       sizeof(wide_bvh_node),
+                       static_cast<uint64_t>(options.bin_count),
+                       static_cast<uint64_t>(options.max_leaf_size)};
+  return fnv1a(source.data(), source.size(), fnv1a(layout, sizeof(layout)));
+}
+
+inline void mesh_cache_sizes(const mesh_cache_header &header, uint64_t size[]) {
+  // Byte size of every section described by the header.
+  size[cache_positions] = header.vertex_count * sizeof(point3);
+  size[cache_normals] = header.has_normals ? header.vertex_count * sizeof(vec3) : 0;
+  size[cache_uvs] = header.has_uvs ? 2 * header.vertex_count * sizeof(real) : 0;
+  size[cache_indices] = 3 * header.triangle_count * sizeof(uint32_t);
+  size[cache_face_normals] = header.triangle_count * sizeof(vec3);
+  size[cache_nodes] = header.node_count * sizeof(wide_bvh_node);
+}
+
+inline uint64_t mesh_cache_align(uint64_t offset) {
+  return (offset + 63) & ~static_cast<uint64_t>(63);
+}
+
+inline bool valid_mesh_cache(const mesh_cache_header &header, const unsigned char *base) {
+  // Whether the mapped arrays are safe to render from: every index names a vertex, and every
+  // node refers to later nodes (so the tree has no cycles), to triangles that exist, and is
+  // shallow enough for the traversal stack. A damaged or hand edited file fails here instead
+  // of sending traversal out of bounds.
+  const auto *indices = reinterpret_cast<const uint32_t *>(base + header.offset[cache_indices]);
+  for (uint64_t i = 0; i < 3 * header.triangle_count; i++) {
+    if (indices[i] >= header.vertex_count) {
+      return false;
+    }
+  }
+
+  const auto *nodes = reinterpret_cast<const wide_bvh_node *>(base + header.offset[cache_nodes]);
+  std::vector<int> depth(header.node_count, 0);
+  for (uint64_t n = 0; n < header.node_count; n++) {
+    for (int k = 0; k < simd_width; k++) {
+      auto child = nodes[n].child[k];
+      uint64_t index = child < 0 ? 0 : static_cast<uint64_t>(child);
+      uint64_t count = nodes[n].count[k];
+      if (count > 0) {
+        if (child < 0 || index + count > header.triangle_count) {
+          return false;
+        }
+      }
+      else if (child >= 0) {
+        if (index <= n || index >= header.node_count) {
+          return false;
+        }
+        depth[child] = std::max(depth[child], depth[n] + 1);
+        if (depth[child] > 64) {
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+inline bool write_mesh_cache(const std::string &path, uint64_t key, const triangle_mesh &mesh) {
+  const auto &arrays = mesh.arrays();
+  const auto &tree = mesh.bvh();
+
+  auto header = mesh_cache_header();  // Value initialized, so the padding is zeroed too.
+  std::memcpy(header.magic, "HEMERAMC", sizeof(header.magic));
+  header.version = mesh_cache_version;
+  header.has_normals = arrays.normals != nullptr;
+  header.has_uvs = arrays.uvs != nullptr;
+  header.key = key;
+  header.vertex_count = arrays.vertex_count;
+  header.triangle_count = arrays.triangle_count;
+  header.node_count = tree.node_count();
+  header.bounds = tree.bounds();
+  header.stats = tree.build_stats();
+
+  const void *data[cache_section_count] = {arrays.positions,
+                                           arrays.normals,
+                                           arrays.uvs,
+                                           arrays.indices,
+                                           arrays.face_normals,
+                                           tree.node_data()};
+  uint64_t size[cache_section_count];
+  mesh_cache_sizes(header, size);
+  uint64_t end = mesh_cache_align(sizeof(header));
+  for (int i = 0; i < cache_section_count; i++) {
+    header.offset[i] = end;
+    end = mesh_cache_align(end + size[i]);
+  }
+
+  auto temporary = path + ".tmp" + std::to_string(getpid());
+  std::ofstream file(temporary, std::ios::binary);
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  const char padding[64] = {};
+  uint64_t written = sizeof(header);
+  for (int i = 0; i < cache_section_count && file; i++) {
+    file.write(padding, static_cast<std::streamsize>(header.offset[i] - written));
+    file.write(static_cast<const char *>(data[i]), static_cast<std::streamsize>(size[i]));
+    written = header.offset[i] + size[i];
+  }
+  file.close();
+
+  if (!file || std::rename(temporary.c_str(), path.c_str()) != 0) {
+    std::remove(temporary.c_str());
+    std::cerr << "ERROR: Couldn't write mesh cache file '" << path << "'.\n";
+    return false;
+  }
+  return true;
+}
+
+inline shared_ptr<triangle_mesh> map_mesh_cache(const std::string &path,
+                                                uint64_t key,
+                                                shared_ptr<material> mat) {
+  // Map the cached mesh in path. Returns null if there is none, or it doesn't match the key.
+  auto file = make_shared<mapped_file>();
+  if (!file->open(path) || file->size() < sizeof(mesh_cache_header)) {
+    return nullptr;
+  }
+
+  mesh_cache_header header;
+  std::memcpy(&header, file->data(), sizeof(header));
+  if (std::memcmp(header.magic, "HEMERAMC", sizeof(header.magic)) != 0 ||
+      header.version != mesh_cache_version || header.key != key)
+  {
+    return nullptr;
+  }
+
+  // Bound the counts by the file size before multiplying them, so a corrupt header can't
+  // overflow the section sizes into passing the checks below.
+  if (header.vertex_count > file->size() / sizeof(point3) ||
+      header.triangle_count > file->size() / (3 * sizeof(uint32_t)) ||
+      header.node_count > file->size() / sizeof(wide_bvh_node))
+  {
+    return nullptr;
+  }
+  uint64_t size[cache_section_count];
+  mesh_cache_sizes(header, size);
+  for (int i = 0; i < cache_section_count; i++) {
+    if (header.offset[i] % 64 != 0 || header.offset[i] > file->size() ||
+        size[i] > file->size() - header.offset[i])
+    {
+      return nullptr;
+    }
+  }
+
+  const auto *base = file->data();
+  if (!valid_mesh_cache(header, base)) {
+    std::cerr << "ERROR: Mesh cache file '" << path << "' is damaged; building the mesh again.\n";
+    return nullptr;
+  }
+
+  mesh_arrays arrays;
+  arrays.positions = reinterpret_cast<const point3 *>(base + header.offset[cache_positions]);
+  if (header.has_normals) {
+    arrays.normals = reinterpret_cast<const vec3 *>(base + header.offset[cache_normals]);
+  }
+  if (header.has_uvs) {
+    arrays.uvs = reinterpret_cast<const real *>(base + header.offset[cache_uvs]);
+  }
+  arrays.indices = reinterpret_cast<const uint32_t *>(base + header.offset[cache_indices]);
+  arrays.face_normals = reinterpret_cast<const vec3 *>(base + header.offset[cache_face_normals]);
+  arrays.vertex_count = header.vertex_count;
+  arrays.triangle_count = header.triangle_count;
+  const auto *nodes = reinterpret_cast<const wide_bvh_node *>(base + header.offset[cache_nodes]);
+
+  return make_shared<triangle_mesh>(
+      file, arrays, nodes, header.node_count, header.bounds, header.stats, mat);
+}
+
+inline bool make_directories(const std::string &path) {
+  // Create the directory path along with any missing parents, like mkdir -p.
+  for (size_t slash = path.find('/', 1); slash != std::string::npos;
+       slash = path.find('/', slash + 1))
+  {
+    if (mkdir(path.substr(0, slash).c_str(), 0777) != 0 && errno != EEXIST) {
+      return false;
+    }
+  }
+  return mkdir(path.c_str(), 0777) == 0 || errno == EEXIST;
+}
+
+inline shared_ptr<triangle_mesh> load_cached_mesh(const std::string &path,
+                                                  const std::string &cache_directory,
+                                                  shared_ptr<material> mat) {
+  // Load the .obj or .ply mesh in path, mapping it from cache_directory if it was cached
+  // there before, and otherwise building it and adding it to the cache. Returns null if the
+  // mesh can't be loaded.
+  bvh_build_options options;
+  uint64_t key;
+  {
+    mapped_file source;
+    if (!source.open(path)) {
+      mesh_error(path, "can't open file");
+      return nullptr;
+    }
+    key = mesh_cache_key(source, options);
+  }
+
+  char name[32];
+  std::snprintf(name, sizeof(name), "%016llx.mesh", static_cast<unsigned long long>(key));
+  auto cache_path = cache_directory + "/" + name;
+  auto cached = map_mesh_cache(cache_path, key, mat);
+  if (cached) {
+    return cached;
+  }
+
+  mesh_data data;
+  if (!load_mesh(path, data)) {
+    return nullptr;
+  }
+  auto mesh = make_shared<triangle_mesh>(std::move(data), mat, options);
+  if (make_directories(cache_directory)) {
+    write_mesh_cache(cache_path, key, *mesh);
+  }
+  else {
+    std::cerr << "ERROR: Couldn't create mesh cache directory '" << cache_directory << "'.\n";
+  }
+  return mesh;
+}
+
+#endif
@@ -0,0 +1,505 @@
+#ifndef MESH_LOADER_H
+#define MESH_LOADER_H
+
+#include "common.h"
+
+#include "triangle_mesh.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Loaders for Wavefront OBJ and binary PLY files into mesh_data. Both read the file as a
+// stream, a line or a buffer at a time, so only the mesh itself has to fit in memory.
+// Polygons with more than three corners are split into triangle fans.
+
+inline bool mesh_error(const std::string &path, const std::string &message) {
+  std::cerr << "ERROR: Couldn't load mesh file '" << path << "': " << message << ".\n";
+  return false;
+}
+
+struct obj_corner {
+  // The position, texture coordinate and normal indices of a face corner; -1 when absent.
+  int position, uv, normal;
+
+  bool operator==(const obj_corner &other) const {
+    return position == other.position && uv == other.uv && normal == other.normal;
+  }
+};
+
+struct obj_corner_hash {
+  size_t operator()(const obj_corner &c) const {
+    auto key = (static_cast<uint64_t>(static_cast<uint32_t>(c.position)) << 32) ^
+               (static_cast<uint64_t>(static_cast<uint32_t>(c.uv)) << 16) ^
+               static_cast<uint32_t>(c.normal);
+    return static_cast<size_t>(pcg32::mix64(key));
+  }
+};
+
+inline bool parse_obj_index(const char *&s, size_t count, int &index) {
+  // Parse a one based (or, when negative, relative to the end) OBJ index into a zero based one.
+  char *end;
+  long value = strtol(s, &end, 10);
+  if (end == s || value == 0) {
+    return false;
+  }
+  s = end;
+  value = value < 0 ? static_cast<long>(count) + value : value - 1;
+  if (value < 0 || value >= static_cast<long>(count)) {
+    return false;
+  }
+  index = static_cast<int>(value);
+  return true;
+}
+
+inline bool load_obj(const std::string &path, mesh_data &mesh) {
+  std::ifstream file(path);
+  if (!file) {
+    return mesh_error(path, "can't open file");
+  }
+
+  std::vector<point3> positions;
+  std::vector<vec3> normals;
+  std::vector<real> uvs;
+
+  // OBJ indexes positions, uvs and normals separately; every distinct combination used by a
+  // face corner becomes one mesh vertex.
+  std::unordered_map<obj_corner, uint32_t, obj_corner_hash> vertices;
+  std::vector<uint32_t> polygon;
+  bool all_normals = true, all_uvs = true;
+
+  mesh = mesh_data();
+  std::string line;
+  for (int line_number = 1; std::getline(file, line); line_number++) {
+    const char *s = line.c_str();
+    while (*s == ' ' || *s == '\t') {
+      s++;
+    }
+    char *end;
+
+    if (s[0] == 'v' && (s[1] == ' ' || s[1] == '\t')) {
+      double x = strtod(s + 2, &end);
+      double y = strtod(end, &end);
+      double z = strtod(end, &end);
+      positions.push_back(point3(x, y, z));
+    }
+    else if (s[0] == 'v' && s[1] == 'n') {
+      double x = strtod(s + 2, &end);
+      double y = strtod(end, &end);
+      double z = strtod(end, &end);
+      normals.push_back(vec3(x, y, z));
+    }
+    else if (s[0] == 'v' && s[1] == 't') {
+      double u = strtod(s + 2, &end);
+      double v = strtod(end, &end);
+      uvs.push_back(u);
+      uvs.push_back(v);
+    }
+    else if (s[0] == 'f' && (s[1] == ' ' || s[1] == '\t')) {
+      polygon.clear();
+      s++;
+      while (true) {
+        while (*s == ' ' || *s == '\t' || *s == '\r') {
+          s++;
+        }
+        if (*s == '\0') {
+          break;
+        }
+
+        // v, v/vt, v//vn or v/vt/vn
+        obj_corner corner{-1, -1, -1};
+        bool valid = parse_obj_index(s, positions.size(), corner.position);
+        if (valid && *s == '/') {
+          s++;
+          if (*s != '/') {
+            valid = parse_obj_index(s, uvs.size() / 2, corner.uv);
+          }
+          if (valid && *s == '/') {
+            s++;
+            valid = parse_obj_index(s, normals.size(), corner.normal);
+          }
+        }
+        if (!valid) {
+          return mesh_error(path, "bad face on line " + std::to_string(line_number));
+        }
+
+        auto found = vertices.find(corner);
+        if (found == vertices.end()) {
+          auto index = static_cast<uint32_t>(mesh.positions.size());
+          found = vertices.insert(std::make_pair(corner, index)).first;
+          mesh.positions.push_back(positions[corner.position]);
+          mesh.normals.push_back(corner.normal >= 0 ? normals[corner.normal] : vec3(0, 0, 0));
+          mesh.uvs.push_back(corner.uv >= 0 ? uvs[2 * corner.uv] : 0);
+          mesh.uvs.push_back(corner.uv >= 0 ? uvs[2 * corner.uv + 1] : 0);
+          all_normals = all_normals && corner.normal >= 0;
+          all_uvs = all_uvs && corner.uv >= 0;
+        }
+        polygon.push_back(found->second);
+      }
+
+      for (size_t k = 2; k < polygon.size(); k++) {
+        mesh.indices.push_back(polygon[0]);
+        mesh.indices.push_back(polygon[k - 1]);
+        mesh.indices.push_back(polygon[k]);
+      }
+    }
+    // Everything else (groups, materials, comments) is ignored.
+  }
+
+  // Attributes only some of the vertices have are dropped altogether.
+  if (!all_normals) {
+    mesh.normals = std::vector<vec3>();
+  }
+  if (!all_uvs) {
+    mesh.uvs = std::vector<real>();
+  }
+  return true;
+}
+
+enum class ply_type { int8, uint8, int16, uint16, int32, uint32, float32, float64 };
+
+inline bool parse_ply_type(const std::string &name, ply_type &type) {
+  static const struct {
+    const char *name;
+    ply_type type;
+  } names[] = {{"char", ply_type::int8},     {"int8", ply_type::int8},
+               {"uchar", ply_type::uint8},   {"uint8", ply_type::uint8},
+               {"short", ply_type::int16},   {"int16", ply_type::int16},
+               {"ushort", ply_type::uint16}, {"uint16", ply_type::uint16},
+               {"int", ply_type::int32},     {"int32", ply_type::int32},
+               {"uint", ply_type::uint32},   {"uint32", ply_type::uint32},
+               {"float", ply_type::float32}, {"float32", ply_type::float32},
+               {"double", ply_type::float64}, {"float64", ply_type::float64}};
+  for (const auto &entry : names) {
+    if (name == entry.name) {
+      type = entry.type;
+      return true;
+    }
+  }
+  return false;
+}
+
+struct ply_property {
+  std::string name;
+  ply_type type;
+  bool is_list;
+  ply_type count_type;  // Type of a list's length prefix.
+};
+
+struct ply_element {
+  std::string name;
+  size_t count;
+  std::vector<ply_property> properties;
+};
+
+class ply_reader {
+  // Buffered reads of binary PLY values, converted to double and byte swapped when the file's
+  // endianness differs from the machine's.
+ public:
+  ply_reader(std::istream &stream, bool big_endian_file)
+      : in(stream), buffer(1 << 16), position(0), size(0) {
+    uint16_t probe = 1;
+    unsigned char first_byte;
+    std::memcpy(&first_byte, &probe, 1);
+    swap_bytes = big_endian_file == (first_byte == 1);
+  }
+
+  bool read(ply_type type, double &value) {
+    unsigned char bytes[8];
+    auto count = type_size(type);
+    if (!read_bytes(bytes, count)) {
+      return false;
+    }
+    if (swap_bytes) {
+      for (size_t i = 0; i < count / 2; i++) {
+        std::swap(bytes[i], bytes[count - 1 - i]);
+      }
+    }
+
+    switch (type) {
+      case ply_type::int8:
+        value = load<int8_t>(bytes);
+        break;
+      case ply_type::uint8:
+        value = load<uint8_t>(bytes);
+        break;
+      case ply_type::int16:
+        value = load<int16_t>(bytes);
+        break;
+      case ply_type::uint16:
+        value = load<uint16_t>(bytes);
+        break;
+      case ply_type::int32:
+        value = load<int32_t>(bytes);
+        break;
+      case ply_type::uint32:
+        value = load<uint32_t>(bytes);
+        break;
+      case ply_type::float32:
+        value = load<float>(bytes);
+        break;
+      case ply_type::float64:
+        value = load<double>(bytes);
+        break;
+    }
+    return true;
+  }
+
+  static size_t type_size(ply_type type) {
+    switch (type) {
+      case ply_type::int8:
+      case ply_type::uint8:
+        return 1;
+      case ply_type::int16:
+      case ply_type::uint16:
+        return 2;
+      case ply_type::int32:
+      case ply_type::uint32:
+      case ply_type::float32:
+        return 4;
+      case ply_type::float64:
+        return 8;
+    }
+    return 0;
+  }
+
+ private:
+  std::istream &in;
+  std::vector<char> buffer;
+  size_t position, size;
+  bool swap_bytes;
+
+  template <typename T>
+  static double load(const unsigned char *bytes) {
+    T value;
+    std::memcpy(&value, bytes, sizeof(T));
+    return static_cast<double>(value);
+  }
+
+  bool read_bytes(unsigned char *out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+      if (position == size) {
+        in.read(buffer.data(), buffer.size());
+        size = static_cast<size_t>(in.gcount());
+        position = 0;
+        if (size == 0) {
+          return false;
+        }
+      }
+      out[i] = static_cast<unsigned char>(buffer[position++]);
+    }
+    return true;
+  }
+};
+
+inline bool load_ply(const std::string &path, mesh_data &mesh) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    return mesh_error(path, "can't open file");
+  }
+
+  // Header
+  std::string line;
+  if (!std::getline(file, line) || line.compare(0, 3, "ply") != 0) {
+    return mesh_error(path, "not a PLY file");
+  }
+  bool big_endian = false;
+  std::vector<ply_element> elements;
+  while (true) {
+    if (!std::getline(file, line)) {
+      return mesh_error(path, "truncated header");
+    }
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+
+    std::vector<std::string> words;
+    for (size_t start = 0; start < line.size();) {
+      auto end = line.find(' ', start);
+      end = end == std::string::npos ? line.size() : end;
+      if (end > start) {
+        words.push_back(line.substr(start, end - start));
+      }
+      start = end + 1;
+    }
+    if (words.empty() || words[0] == "comment" || words[0] == "obj_info") {
+      continue;
+    }
+
+    if (words[0] == "end_header") {
+      break;
+    }
+    else if (words[0] == "format" && words.size() >= 2) {
+      if (words[1] == "binary_little_endian") {
+        big_endian = false;
+      }
+      else if (words[1] == "binary_big_endian") {
+        big_endian = true;
+      }
+      else {
+        return mesh_error(path, "only binary PLY files are supported");
+      }
+    }
+    else if (words[0] == "element" && words.size() >= 3) {
+      elements.push_back(ply_element{words[1], strtoul(words[2].c_str(), nullptr, 10), {}});
+    }
+    else if (words[0] == "property" && !elements.empty()) {
+      ply_property property;
+      property.is_list = words.size() >= 5 && words[1] == "list";
+      bool valid = property.is_list ? parse_ply_type(words[2], property.count_type) &&
+                                          parse_ply_type(words[3], property.type)
+                                    : words.size() >= 3 && parse_ply_type(words[1], property.type);
+      if (!valid) {
+        return mesh_error(path, "unsupported property '" + line + "'");
+      }
+      property.name = words.back();
+      elements.back().properties.push_back(property);
+    }
+  }
+
+  // Body, element by element in header order.
+  auto body_start = file.tellg();
+  file.seekg(0, std::ios::end);
+  auto body_bytes = static_cast<size_t>(file.tellg() - body_start);
+  file.seekg(body_start);
+
+  mesh = mesh_data();
+  ply_reader reader(file, big_endian);
+  size_t vertex_count = 0;
+  std::vector<double> values;
+  std::vector<uint32_t> polygon;
+
+  for (const auto &element : elements) {
+    bool is_vertex = element.name == "vertex";
+    bool is_face = element.name == "face";
+
+    // Where each attribute is found among the element's properties, -1 when it's missing.
+    int position[3] = {-1, -1, -1}, normal[3] = {-1, -1, -1}, uv[2] = {-1, -1};
+    int face_indices = -1;
+    for (int i = 0; i < static_cast<int>(element.properties.size()); i++) {
+      const auto &name = element.properties[i].name;
+      static const char *position_names[] = {"x", "y", "z"};
+      static const char *normal_names[] = {"nx", "ny", "nz"};
+      for (int a = 0; a < 3; a++) {
+        position[a] = name == position_names[a] ? i : position[a];
+        normal[a] = name == normal_names[a] ? i : normal[a];
+      }
+      if (name == "u" || name == "s" || name == "texture_u" || name == "texture_s") {
+        uv[0] = i;
+      }
+      if (name == "v" || name == "t" || name == "texture_v" || name == "texture_t") {
+        uv[1] = i;
+      }
+      if (element.properties[i].is_list &&
+          (name == "vertex_indices" || name == "vertex_index"))
+      {
+        face_indices = i;
+      }
+    }
+    if (is_vertex && (position[0] < 0 || position[1] < 0 || position[2] < 0)) {
+      return mesh_error(path, "vertices without x, y and z");
+    }
+    bool has_normals = normal[0] >= 0 && normal[1] >= 0 && normal[2] >= 0;
+    bool has_uvs = uv[0] >= 0 && uv[1] >= 0;
+
+    if (is_vertex) {
+      // The count comes from the header, so reserve no more vertices than the rest of the file
+      // can hold; a bogus count then fails with an error below instead of a huge allocation.
+      vertex_count = element.count;
+      size_t vertex_bytes = 0;
+      for (const auto &property : element.properties) {
+        vertex_bytes += ply_reader::type_size(property.is_list ? property.count_type
+                                                               : property.type);
+      }
+      auto reserved = std::min(vertex_count, body_bytes / std::max<size_t>(vertex_bytes, 1));
+      mesh.positions.reserve(reserved);
+      if (has_normals) {
+        mesh.normals.reserve(reserved);
+      }
+      if (has_uvs) {
+        mesh.uvs.reserve(2 * reserved);
+      }
+    }
+
+    values.resize(element.properties.size());
+    for (size_t item = 0; item < element.count; item++) {
+      for (size_t i = 0; i < element.properties.size(); i++) {
+        const auto &property = element.properties[i];
+        if (!property.is_list) {
+          if (!reader.read(property.type, values[i])) {
+            return mesh_error(path, "unexpected end of file");
+          }
+          continue;
+        }
+
+        double length;
+        if (!reader.read(property.count_type, length)) {
+          return mesh_error(path, "unexpected end of file");
+        }
+        // Counts and indices may come from signed types, so check their range while they are
+        // still doubles; converting a negative or oversized one would be undefined.
+        const double max_index = 4294967295.0;
+        if (!(length >= 0 && length <= max_index)) {
+          return mesh_error(path,
+                            element.name + " " + std::to_string(item) + " has a bad list length");
+        }
+        polygon.clear();
+        for (size_t k = 0; k < static_cast<size_t>(length); k++) {
+          double index;
+          if (!reader.read(property.type, index)) {
+            return mesh_error(path, "unexpected end of file");
+          }
+          if (!(index >= 0 && index <= max_index)) {
+            return mesh_error(
+                path, element.name + " " + std::to_string(item) + " has a bad vertex index");
+          }
+          polygon.push_back(static_cast<uint32_t>(index));
+        }
+
+        if (is_face && static_cast<int>(i) == face_indices) {
+          for (auto index : polygon) {
+            if (index >= vertex_count) {
+              return mesh_error(path, "face " + std::to_string(item) + " has a bad vertex index");
+            }
+          }
+          for (size_t k = 2; k < polygon.size(); k++) {
+            mesh.indices.push_back(polygon[0]);
+            mesh.indices.push_back(polygon[k - 1]);
+            mesh.indices.push_back(polygon[k]);
+          }
+        }
+      }
+
+      if (is_vertex) {
+        mesh.positions.push_back(
+            point3(values[position[0]], values[position[1]], values[position[2]]));
+        if (has_normals) {
+          mesh.normals.push_back(vec3(values[normal[0]], values[normal[1]], values[normal[2]]));
+        }
+        if (has_uvs) {
+          mesh.uvs.push_back(values[uv[0]]);
+          mesh.uvs.push_back(values[uv[1]]);
+        }
+      }
+    }
+  }
+  return true;
+}
+
+inline bool load_mesh(const std::string &path, mesh_data &mesh) {
+  // Load an .obj or .ply file, choosing the format from the file extension.
+  if (has_extension(path, ".obj")) {
+    return load_obj(path, mesh);
+  }
+  if (has_extension(path, ".ply")) {
+    return load_ply(path, mesh);
+  }
+  return mesh_error(path, "unknown mesh format");
+}
+
+#endif
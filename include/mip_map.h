@@ -0,0 +1,141 @@
+#ifndef MIP_MAP_H
+#define MIP_MAP_H
+
+#include "common.h"
+
+#include "color.h"
+#include "uv_image.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+class mip_map {
+  // An image as a pyramid of levels, each half the size of the one before, down to a single
+  // texel, so a lookup can average over any footprint by reading a handful of texels from the
+  // level whose texels are about the footprint's size.
+  //
+  // Texels are converted once, when the pyramid is built, to floats (the 8-bit value / 255).
+  // Every level is stored in 8x8 texel tiles, with the texels of a tile in Morton (Z) order:
+  // the 2x2 texels a bilinear lookup reads, and the lookups of neighbouring rays, then mostly
+  // fall on the same few cache lines instead of on rows a whole image width apart.
+ public:
+  void build(const uv_image &image) {
+    levels.clear();
+    if (image.width() <= 0 || image.height() <= 0) {
+      return;
+    }
+
+    levels.push_back(level(image.width(), image.height()));
+    for (int y = 0; y < image.height(); y++) {
+      for (int x = 0; x < image.width(); x++) {
+        auto pixel = image.pixel_data(x, y);
+        auto *texel = levels[0].texel(x, y);
+        for (int c = 0; c < 3; c++) {
+          texel[c] = pixel[c] / 255.0f;
+        }
+      }
+    }
+
+    // Each texel of the next level is the average of the (up to) 2x2 texels it covers.
+    while (levels.back().width > 1 || levels.back().height > 1) {
+      const auto &fine = levels.back();
+      level coarse(std::max(1, fine.width / 2), std::max(1, fine.height / 2));
+      for (int y = 0; y < coarse.height; y++) {
+        for (int x = 0; x < coarse.width; x++) {
+          int x0 = std::min(2 * x, fine.width - 1), x1 = std::min(2 * x + 1, fine.width - 1);
+          int y0 = std::min(2 * y, fine.height - 1), y1 = std::min(2 * y + 1, fine.height - 1);
+          auto *texel = coarse.texel(x, y);
+          for (int c = 0; c < 3; c++) {
+            texel[c] = 0.25f * (fine.texel(x0, y0)[c] + fine.texel(x1, y0)[c] +
+                                fine.texel(x0, y1)[c] + fine.texel(x1, y1)[c]);
+          }
+        }
+      }
+      levels.push_back(std::move(coarse));
+    }
+  }
+
+  bool empty() const {
+    return levels.empty();
+  }
+
+  color sample(double u, double v, double footprint) const {
+    // The image around (u, v), averaged over a square about footprint wide, with u and v in
+    // [0, 1] and v running down the image. Blends the two levels closest to the footprint,
+    // each filtered bilinearly (trilinear filtering).
+    const auto &base = levels[0];
+    auto size = std::sqrt(static_cast<double>(base.width) * base.height);
+    auto lod = footprint > 0 ? std::log2(footprint * size) : 0;
+    lod = std::min(std::max(lod, 0.0), static_cast<double>(levels.size() - 1));
+
+    int fine = static_cast<int>(lod);
+    auto blend = lod - fine;
+    auto result = bilinear(levels[fine], u, v);
+    if (blend > 0) {
+      result = (1 - blend) * result + blend * bilinear(levels[fine + 1], u, v);
+    }
+    return result;
+  }
+
+ private:
+  static const int tile_bits = 3;  // Tiles are 8x8 texels.
+  static const int tile_size = 1 << tile_bits;
+
+  struct level {
+    int width, height;
+    int tiles_x;               // Tiles per row.
+    std::vector<float> data;  // Three floats per texel.
+
+    level(int w, int h)
+        : width(w),
+          height(h),
+          tiles_x((w + tile_size - 1) >> tile_bits),
+          data(3 * tiles_x * ((h + tile_size - 1) >> tile_bits) * tile_size * tile_size) {}
+
+    float *texel(int x, int y) {
+      return &data[offset(x, y)];
+    }
+    const float *texel(int x, int y) const {
+      return &data[offset(x, y)];
+    }
+
+    size_t offset(int x, int y) const {
+      size_t tile = static_cast<size_t>(y >> tile_bits) * tiles_x + (x >> tile_bits);
+      int within = spread_bits(x & (tile_size - 1)) | (spread_bits(y & (tile_size - 1)) << 1);
+      return 3 * ((tile << (2 * tile_bits)) + within);
+    }
+
+    static int spread_bits(int n) {
+      // Move bit i of a 4 bit number to bit 2i, to interleave x and y into a Morton index.
+      n = (n | (n << 2)) & 0x33;
+      return (n | (n << 1)) & 0x55;
+    }
+  };
+
+  std::vector<level> levels;
+
+  static color bilinear(const level &l, double u, double v) {
+    // Texel centers are at half integer coordinates; coordinates outside the image clamp to
+    // its edge texels.
+    auto x = u * l.width - 0.5, y = v * l.height - 0.5;
+    auto fx = std::floor(x), fy = std::floor(y);
+    auto wx = x - fx, wy = y - fy;
+    int x0 = std::min(std::max(static_cast<int>(fx), 0), l.width - 1);
+    int y0 = std::min(std::max(static_cast<int>(fy), 0), l.height - 1);
+    int x1 = std::min(std::max(static_cast<int>(fx) + 1, 0), l.width - 1);
+    int y1 = std::min(std::max(static_cast<int>(fy) + 1, 0), l.height - 1);
+
+    const float *t00 = l.texel(x0, y0), *t10 = l.texel(x1, y0);
+    const float *t01 = l.texel(x0, y1), *t11 = l.texel(x1, y1);
+    double c[3];
+    for (int i = 0; i < 3; i++) {
+      auto top = t00[i] + wx * (t10[i] - t00[i]);
+      auto bottom = t01[i] + wx * (t11[i] - t01[i]);
+      c[i] = top + wy * (bottom - top);
+    }
+    return color(c[0], c[1], c[2]);
+  }
+};
+
+#endif
@@ -3,12 +3,23 @@
 
 #include "common.h"
 
+#include "aabb.h"
+#include "simd.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
 class perlin {
  public:
   perlin() {
     ranvec = new vec3[point_count];
     for (int i = 0; i < point_count; ++i) {
       ranvec[i] = unit_vector(vec3::random(-1, 1));
+      gradient_x[i] = static_cast<float>(ranvec[i].x());
+      gradient_y[i] = static_cast<float>(ranvec[i].y());
+      gradient_z[i] = static_cast<float>(ranvec[i].z());
     }
     perm_x = perlin_generate_perm();
     perm_y = perlin_generate_perm();
@@ -44,14 +55,61 @@ class perlin {
   }
 
   double turb(const point3 &p, int depth) const {
+    // The sum of depth octaves of noise, each at twice the frequency and half the weight of the
+    // one before. The octaves are evaluated simd_width at a time, one per lane: only the
+    // lattice cell and the offset into it are found octave by octave, in double precision;
+    // the hashing, the gradients at the eight corners and the interpolation are then computed
+    // for all the lanes together. Lanes past the last octave are computed but not added.
+    int cell[3][simd_width];
+    float fraction[3][simd_width];
+    float octave_noise[simd_width];
     auto accum = 0.0;
-    auto temp_p = p;
+    auto frequency = 1.0;
     auto weight = 1.0;
 
-    for (int i = 0; i < depth; i++) {
-      accum += weight * noise(temp_p);
-      weight *= 0.5;
-      temp_p *= 2;
+    for (int first = 0; first < depth; first += simd_width) {
+      for (int lane = 0; lane < simd_width; lane++) {
+        for (int axis = 0; axis < 3; axis++) {
+          auto x = frequency * p[axis];
+          auto floor_x = floor(x);
+          cell[axis][lane] = static_cast<int>(floor_x);
+          fraction[axis][lane] = static_cast<float>(x - floor_x);
+        }
+        frequency *= 2;
+      }
+
+      simd_int one_cell(1), wrap(point_count - 1);
+      simd_float one(1.0f), two(2.0f), three(3.0f);
+      simd_int hash[2][3];
+      simd_float offset[2][3], smooth[2][3];
+      const int *perm[3] = {perm_x, perm_y, perm_z};
+      for (int axis = 0; axis < 3; axis++) {
+        auto c = simd_int::load(cell[axis]);
+        hash[0][axis] = gather(perm[axis], c & wrap);
+        hash[1][axis] = gather(perm[axis], (c + one_cell) & wrap);
+
+        auto f = simd_float::load(fraction[axis]);
+        auto hermite = f * f * (three - two * f);
+        offset[0][axis] = f;
+        offset[1][axis] = f - one;
+        smooth[0][axis] = one - hermite;
+        smooth[1][axis] = hermite;
+      }
+
+      simd_float sum(0.0f);
+      for (int corner = 0; corner < 8; corner++) {
+        int i = corner >> 2, j = (corner >> 1) & 1, k = corner & 1;
+        auto n = hash[i][0] ^ hash[j][1] ^ hash[k][2];
+        auto dot = gather(gradient_x, n) * offset[i][0] + gather(gradient_y, n) * offset[j][1] +
+                   gather(gradient_z, n) * offset[k][2];
+        sum = sum + smooth[i][0] * smooth[j][1] * smooth[k][2] * dot;
+      }
+
+      sum.store(octave_noise);
+      for (int lane = 0; lane < simd_width && first + lane < depth; lane++) {
+        accum += weight * octave_noise[lane];
+        weight *= 0.5;
+      }
     }
     return fabs(accum);
   }
@@ -59,6 +117,9 @@ class perlin {
  private:
   static const int point_count = 256;
   vec3 *ranvec;
+  float gradient_x[point_count];  // ranvec as separate float arrays, for turb()
+  float gradient_y[point_count];
+  float gradient_z[point_count];
   int *perm_x;
   int *perm_y;
   int *perm_z;
@@ -102,4 +163,88 @@ class perlin {
   }
 };
 
-#endif
\ No newline at end of file
+class noise_volume {
+  // Turbulence sampled once on a regular grid over a box, and read back by trilinear
+  // interpolation. A lookup is eight loads instead of a full turb() evaluation, at the cost
+  // of the detail finer than the grid spacing, so it suits scenes where the noise is viewed
+  // from a distance or through a medium.
+ public:
+  void bake(const perlin &noise, const aabb &box, int resolution, int depth) {
+    // Sample turb(p, depth) over box, with resolution cells along its longest side and cells of
+    // the same size along the others. An axis with no extent (a box around a flat quad, whose
+    // aabb padding can round away in float) gets one cell, and every lookup reads its first
+    // sample along it.
+    bounds = box;
+    auto longest = std::max(box.x.size(), std::max(box.y.size(), box.z.size()));
+    double spacing[3];
+    for (int axis = 0; axis < 3; axis++) {
+      auto extent = box.axis(axis).size();
+      if (!(extent > 0)) {
+        cells[axis] = 1;
+        scale[axis] = spacing[axis] = 0;
+        continue;
+      }
+      cells[axis] = std::max(1, static_cast<int>(std::ceil(resolution * extent / longest)));
+      scale[axis] = cells[axis] / extent;
+      spacing[axis] = extent / cells[axis];
+    }
+
+    // A grid can hold millions of samples, so the slices are baked in parallel.
+    size_t row = cells[0] + 1, slice = row * (cells[1] + 1);
+    values.resize(slice * (cells[2] + 1));
+    thread_pool pool;
+    for (int k = 0; k <= cells[2]; k++) {
+      pool.submit([this, &noise, &box, &spacing, depth, row, slice, k] {
+        auto *value = &values[k * slice];
+        for (int j = 0; j <= cells[1]; j++) {
+          for (int i = 0; i <= cells[0]; i++) {
+            point3 p(box.x.min + i * spacing[0],
+                     box.y.min + j * spacing[1],
+                     box.z.min + k * spacing[2]);
+            value[j * row + i] = static_cast<float>(noise.turb(p, depth));
+          }
+        }
+      });
+    }
+    pool.wait();
+  }
+
+  void print(std::ostream &out) const {
+    out << "Noise: baked " << cells[0] + 1 << "x" << cells[1] + 1 << "x" << cells[2] + 1
+        << " samples\n";
+  }
+
+  bool lookup(const point3 &p, double &value) const {
+    // The interpolated turbulence at p. Returns false if p is outside the baked box.
+    if (values.empty() || !bounds.x.contains(p.x()) || !bounds.y.contains(p.y()) ||
+        !bounds.z.contains(p.z()))
+    {
+      return false;
+    }
+
+    int cell[3];
+    double f[3];
+    for (int axis = 0; axis < 3; axis++) {
+      auto x = (p[axis] - bounds.axis(axis).min) * scale[axis];
+      cell[axis] = std::min(static_cast<int>(x), cells[axis] - 1);
+      f[axis] = x - cell[axis];
+    }
+
+    size_t row = cells[0] + 1, slice = row * (cells[1] + 1);
+    const float *c = &values[cell[2] * slice + cell[1] * row + cell[0]];
+    auto lerp = [](double a, double b, double t) { return a + t * (b - a); };
+    auto near = lerp(lerp(c[0], c[1], f[0]), lerp(c[row], c[row + 1], f[0]), f[1]);
+    c += slice;
+    auto far = lerp(lerp(c[0], c[1], f[0]), lerp(c[row], c[row + 1], f[0]), f[1]);
+    value = lerp(near, far, f[2]);
+    return true;
+  }
+
+ private:
+  aabb bounds;
+  int cells[3];
+  double scale[3];  // Cells per unit length along each axis.
+  std::vector<float> values;
+};
+
+#endif
@@ -3,6 +3,7 @@
 
 #include "common.h"
 #include "hittable.h"
+#include "hittable_list.h"
 
 #include <cmath>
 
@@ -14,6 +15,8 @@ class quad : public hittable {
     normal = unit_vector(n);
     D = dot(normal, Q);
     w = n / dot(n, n);
+    area = n.length();
+    uv_density = 1 / sqrt(u.length() * v.length());
 
     set_boudning_box();
   }
@@ -27,38 +30,94 @@ class quad : public hittable {
   }
 
   bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
-    auto denom = dot(normal, r.direction());
-    // No hit if the ray is parallel to the plane.
-    if (fabs(denom) < 1e-8) {
+    HEMERA_COUNT(stat_quad_tests);
+    if (!intersect(r, ray_t, rec)) {
       return false;
     }
+    HEMERA_COUNT(stat_quad_hits);
+    return true;
+  }
 
-    // Return false if the hit point parameter t is outside the ray interval.
-    auto t = (D - dot(normal, r.origin())) / denom;
-    if (!ray_t.contains(t)) {
-      return false;
+  void finalize(const ray &r, hit_record &rec) const override {
+    rec.p = r.at(rec.t);
+    rec.mat = mat.get();
+    rec.set_face_normal(r, normal);
+    rec.uv_density = uv_density;
+  }
+
+  int hit_packet(const ray_packet &packet,
+                 real t_min,
+                 real t_max[],
+                 hit_record rec[],
+                 int active) const override {
+    // Intersect the plane and compute the planar coordinates for every lane at once, then
+    // run the interior test and record the lanes that hit.
+    HEMERA_COUNT_N(stat_quad_tests, lane_count(active));
+    const int n = ray_packet::size;
+    real hit_t[n], alpha[n], beta[n];
+
+    for (int k = 0; k < n; k++) {
+      real dx = packet.direction[0][k], dy = packet.direction[1][k];
+      real dz = packet.direction[2][k];
+      real ox = packet.origin[0][k], oy = packet.origin[1][k], oz = packet.origin[2][k];
+
+      real denom = normal.x() * dx + normal.y() * dy + normal.z() * dz;
+      real t = (D - (normal.x() * ox + normal.y() * oy + normal.z() * oz)) / denom;
+      bool valid = fabs(denom) >= 1e-8 && t_min <= t && t <= t_max[k];
+
+      // Planar hit point vector, relative to the corner Q.
+      real px = ox + t * dx - Q.x();
+      real py = oy + t * dy - Q.y();
+      real pz = oz + t * dz - Q.z();
+
+      // alpha = w . (p x v), beta = w . (u x p)
+      alpha[k] = w.x() * (py * v.z() - pz * v.y()) + w.y() * (pz * v.x() - px * v.z()) +
+                 w.z() * (px * v.y() - py * v.x());
+      beta[k] = w.x() * (u.y() * pz - u.z() * py) + w.y() * (u.z() * px - u.x() * pz) +
+                w.z() * (u.x() * py - u.y() * px);
+      hit_t[k] = valid ? t : -infinity;
     }
 
-    // Determine if the hit point lies within the planar shape using its plane coordinates.
-    auto intersection = r.at(t);
-    vec3 planar_hitpt_vector = intersection - Q;
-    auto alpha = dot(w, cross(planar_hitpt_vector, v));
-    auto beta = dot(w, cross(u, planar_hitpt_vector));
+    int hits = 0;
+    for (int k = 0; k < n; k++) {
+      if (!(active & (1 << k)) || hit_t[k] == -infinity ||
+          !is_interior(alpha[k], beta[k], rec[k]))
+      {
+        continue;
+      }
+      rec[k].t = hit_t[k];
+      rec[k].object = this;
+      t_max[k] = hit_t[k];
+      hits |= 1 << k;
+    }
+    HEMERA_COUNT_N(stat_quad_hits, lane_count(hits));
+    return hits;
+  }
 
-    if (!is_interior(alpha, beta, rec)) {
-      return false;
+  double pdf_value(const point3 &origin, const vec3 &direction) const override {
+    // Uniform area sampling, converted to solid angle: distance^2 / (cos * area).
+    hit_record rec;
+    if (!intersect(ray(origin, direction, 0), interval(0.001, infinity), rec)) {
+      return 0;
     }
 
-    // Ray hits the 2D shape; set the rest of the hit record and return true.
-    rec.t = t;
-    rec.p = intersection;
-    rec.mat = mat;
-    rec.set_face_normal(r, normal);
+    auto distance_squared = rec.t * rec.t * direction.length_squared();
+    auto cosine = fabs(dot(direction, normal) / direction.length());
+    return distance_squared / (cosine * area);
+  }
 
-    return true;
+  vec3 random(const point3 &origin) const override {
+    auto p = Q + (random_double() * u) + (random_double() * v);
+    return p - origin;
+  }
+
+  void gather_lights(std::vector<const hittable *> &lights) const override {
+    if (mat->is_emissive()) {
+      lights.push_back(this);
+    }
   }
 
-  virtual bool is_interior(double a, double b, hit_record &rec) const {
+  virtual bool is_interior(real a, real b, hit_record &rec) const {
     interval region = interval(0, 1);
     // Given the hit point in plane coordinates, return false if it is outside the
     // primitive, otherwise set the hit record UV coordinates and return true.
@@ -78,18 +137,76 @@ class quad : public hittable {
   shared_ptr<material> mat;
   aabb bbox;
   vec3 normal;
-  double D;
+  real D;
+  real area;
+  real uv_density;
+
+  bool intersect(const ray &r, interval ray_t, hit_record &rec) const {
+    // The ray test shared by hit() and pdf_value(). Only hit() counts it, so light pdf
+    // queries don't show up in the statistics as primitive tests.
+    auto denom = dot(normal, r.direction());
+    // No hit if the ray is parallel to the plane.
+    if (fabs(denom) < 1e-8) {
+      return false;
+    }
+
+    // Return false if the hit point parameter t is outside the ray interval.
+    auto t = (D - dot(normal, r.origin())) / denom;
+    if (!ray_t.contains(t)) {
+      return false;
+    }
+
+    // Determine if the hit point lies within the planar shape using its plane coordinates.
+    auto intersection = r.at(t);
+    vec3 planar_hitpt_vector = intersection - Q;
+    auto alpha = dot(w, cross(planar_hitpt_vector, v));
+    auto beta = dot(w, cross(u, planar_hitpt_vector));
+
+    if (!is_interior(alpha, beta, rec)) {
+      return false;
+    }
+
+    // Ray hits the 2D shape; is_interior has set the uv coordinates.
+    rec.t = t;
+    rec.object = this;
+    return true;
+  }
 };
 
-inline shared_ptr<hittable_list> box(const point3 &a, const point3 &b, shared_ptr<material> mat) {
-  //  Returns the 3D box (six sides) that contains the two opposing verticies a & b.
+class box_sides : public hittable_list {
+  // The six quads of an axis-aligned box, which also knows the box it encloses, so a medium
+  // inside it finds where a ray enters and leaves with one slab test.
+ public:
+  box_sides(const point3 &min, const point3 &max) : min(min), max(max) {}
+
+  bool hit_interval(const ray &r, interval &inside) const override {
+    inside = interval::universe;
+    for (int axis = 0; axis < 3; axis++) {
+      auto inv_d = 1 / r.direction()[axis];
+      auto t0 = (min[axis] - r.origin()[axis]) * inv_d;
+      auto t1 = (max[axis] - r.origin()[axis]) * inv_d;
+      if (inv_d < 0) {
+        std::swap(t0, t1);
+      }
+      inside.min = fmax(inside.min, t0);
+      inside.max = fmin(inside.max, t1);
+    }
+    return inside.min < inside.max;
+  }
 
-  auto sides = make_shared<hittable_list>();
+ private:
+  point3 min, max;
+};
+
+inline shared_ptr<box_sides> box(const point3 &a, const point3 &b, shared_ptr<material> mat) {
+  //  Returns the 3D box (six sides) that contains the two opposing verticies a & b.
 
   // Construct the two opposite vertices with the minumum and maximum coordinates.
   auto min = point3(fmin(a.x(), b.x()), fmin(a.y(), b.y()), fmin(a.z(), b.z()));
   auto max = point3(fmax(a.x(), b.x()), fmax(a.y(), b.y()), fmax(a.z(), b.z()));
 
+  auto sides = make_shared<box_sides>(min, max);
+
   auto dx = vec3(max.x() - min.x(), 0, 0);
   auto dy = vec3(0, max.y() - min.y(), 0);
   auto dz = vec3(0, 0, max.z() - min.z());
@@ -3,34 +3,57 @@
 
 #include "vec3.h"
 
-class ray {
- public:
-  ray() {}
+#include <limits>
 
-  ray(const point3 &origin, const vec3 &direction) : orig(origin), dir(direction), tm(0) {}
+template <typename T>
+class basic_ray {
+ public:
+  basic_ray() {}
 
-  ray(const point3 &origin, const vec3 &direction, double time = 0.0)
+  basic_ray(const basic_vec3<T> &origin, const basic_vec3<T> &direction, T time = 0)
       : orig(origin), dir(direction), tm(time) {}
 
-  point3 origin() const {
+  basic_vec3<T> origin() const {
     return orig;
   }
-  vec3 direction() const {
+  basic_vec3<T> direction() const {
     return dir;
   }
 
-  double time() const {
+  T time() const {
     return tm;
   }
 
-  point3 at(double t) const {
+  basic_vec3<T> at(T t) const {
     return orig + t * dir;
   }
 
  private:
-  point3 orig;
-  vec3 dir;
-  double tm;
+  basic_vec3<T> orig;
+  basic_vec3<T> dir;
+  T tm;
 };
 
-#endif
\ No newline at end of file
+using ray = basic_ray<real>;
+
+template <typename T>
+inline basic_vec3<T> offset_ray_origin(const basic_vec3<T> &p,
+                                       const basic_vec3<T> &normal,
+                                       const basic_vec3<T> &direction) {
+  // Move a hit point off its surface, to the side the new ray leaves towards, so the ray can't
+  // hit the surface it starts on through rounding error in p. The step is a fixed number of
+  // ulps of each coordinate, with a floor near the origin (after Wachter and Binder, "A Fast
+  // and Robust Method for Avoiding Self-Intersection", Ray Tracing Gems). It is what keeps
+  // float renders free of acne; in double it's far below anything visible.
+  const T relative = 256 * std::numeric_limits<T>::epsilon();
+  const T floor = relative / 32;
+  auto n = dot(normal, direction) < 0 ? -normal : normal;
+
+  basic_vec3<T> offset;
+  for (int a = 0; a < 3; a++) {
+    offset[a] = p[a] + n[a] * std::fmax(std::fabs(p[a]) * relative, floor);
+  }
+  return offset;
+}
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include "ray.h"
+#include "rng.h"
+#include "simd.h"
+
+class ray_packet {
+  // A bundle of up to simd_width coherent rays, e.g. the camera rays of neighbouring pixels.
+  // The rays are kept both as ray objects, for the single ray fallback, and as structure of
+  // arrays, so packet kernels can process all lanes with the same instructions.
+ public:
+  static const int size = simd_width;
+
+  ray rays[size];
+  real origin[3][size];
+  real direction[3][size];
+  real time[size];
+  int active;  // Bit i is set when lane i holds a ray.
+
+  // Optional per lane random generators. Hittables that fall back to tracing lanes one by one
+  // swap each lane's generator in, so random decisions made during intersection (e.g. in a
+  // participating medium) still draw from the stream of the sample that lane belongs to.
+  pcg32 *rng;
+
+  ray_packet() : active(0), rng(nullptr) {
+    // Packet kernels compute every lane and mask the results afterwards, so the lanes that
+    // never get a ray hold a harmless one instead of uninitialized values.
+    ray idle(point3(0, 0, 0), vec3(1, 0, 0), 0);
+    for (int lane = 0; lane < size; lane++) {
+      store(lane, idle);
+    }
+  }
+
+  void set(int lane, const ray &r) {
+    store(lane, r);
+    active |= 1 << lane;
+  }
+
+ private:
+  void store(int lane, const ray &r) {
+    rays[lane] = r;
+    for (int a = 0; a < 3; a++) {
+      origin[a][lane] = r.origin()[a];
+      direction[a][lane] = r.direction()[a];
+    }
+    time[lane] = r.time();
+  }
+};
+
+inline int lane_count(int lanes) {
+  // Number of set bits in a lane mask.
+  int count = 0;
+  for (; lanes != 0; lanes &= lanes - 1) {
+    count++;
+  }
+  return count;
+}
+
+#endif
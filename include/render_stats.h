@@ -0,0 +1,183 @@
+#ifndef RENDER_STATS_H
+#define RENDER_STATS_H
+// Counters of the work a render does: rays traced, BVH nodes visited, primitive tests and hits,
+// medium collisions and scattering events. They are compiled in only when building with
+// HEMERA_STATS (make STATS=on); otherwise HEMERA_COUNT expands to nothing and the hot paths
+// are exactly as without them.
+//
+// Every thread counts into its own block, so counting is a plain increment with no sharing
+// between cores. The blocks outlive their threads and are summed when the report is written.
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef HEMERA_STATS
+#  include <mutex>
+#endif
+
+enum stat_counter {
+  stat_camera_rays,
+  stat_bounce_rays,
+  stat_shadow_rays,
+  stat_bvh_nodes,         // Interior nodes whose children were box tested, by one ray
+  stat_bvh_packet_nodes,  // ... or by a packet
+  stat_bvh_leaves,
+  stat_sphere_tests,
+  stat_sphere_hits,
+  stat_quad_tests,
+  stat_quad_hits,
+  stat_triangle_tests,
+  stat_triangle_hits,
+  stat_mesh_triangle_tests,
+  stat_mesh_triangle_hits,
+  stat_medium_tests,
+  stat_medium_scatters,
+  stat_volume_tests,
+  stat_volume_collisions,  // Tentative collisions drawn against the majorants
+  stat_volume_scatters,
+  stat_emitter_hits,
+  stat_lambertian_scatters,
+  stat_metal_scatters,
+  stat_dielectric_scatters,
+  stat_isotropic_scatters,
+  stat_count
+};
+
+inline const char *stat_name(int counter) {
+  static const char *names[stat_count] = {"camera_rays",
+                                          "bounce_rays",
+                                          "shadow_rays",
+                                          "bvh_nodes",
+                                          "bvh_packet_nodes",
+                                          "bvh_leaves",
+                                          "sphere_tests",
+                                          "sphere_hits",
+                                          "quad_tests",
+                                          "quad_hits",
+                                          "triangle_tests",
+                                          "triangle_hits",
+                                          "mesh_triangle_tests",
+                                          "mesh_triangle_hits",
+                                          "medium_tests",
+                                          "medium_scatters",
+                                          "volume_tests",
+                                          "volume_collisions",
+                                          "volume_scatters",
+                                          "emitter_hits",
+                                          "lambertian_scatters",
+                                          "metal_scatters",
+                                          "dielectric_scatters",
+                                          "isotropic_scatters"};
+  return names[counter];
+}
+
+#ifdef HEMERA_STATS
+
+struct stat_block {
+  uint64_t counts[stat_count] = {};
+  char padding[64];  // Keeps the counts of two threads off a shared cache line.
+};
+
+inline std::mutex &stat_blocks_mutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+inline std::vector<stat_block *> &stat_blocks() {
+  // Every thread's block. They are never freed, so their counts survive the threads.
+  static std::vector<stat_block *> blocks;
+  return blocks;
+}
+
+inline stat_block &thread_stats() {
+  // A null pointer is constant initialized, so reaching the block costs no guard check.
+  thread_local stat_block *block = nullptr;
+  if (!block) {
+    block = new stat_block();
+    std::lock_guard<std::mutex> lock(stat_blocks_mutex());
+    stat_blocks().push_back(block);
+  }
+  return *block;
+}
+
+#  define HEMERA_COUNT(counter) (thread_stats().counts[counter]++)
+#  define HEMERA_COUNT_N(counter, n) (thread_stats().counts[counter] += (n))
+
+#else
+
+#  define HEMERA_COUNT(counter) ((void)0)
+#  define HEMERA_COUNT_N(counter, n) ((void)0)
+
+#endif
+
+inline bool stats_enabled() {
+#ifdef HEMERA_STATS
+  return true;
+#else
+  return false;
+#endif
+}
+
+inline void thread_counts(uint64_t counts[stat_count]) {
+  // The counts of the calling thread so far, all zero when the counters are compiled out.
+  for (int i = 0; i < stat_count; i++) {
+#ifdef HEMERA_STATS
+    counts[i] = thread_stats().counts[i];
+#else
+    counts[i] = 0;
+#endif
+  }
+}
+
+inline void collect_stats(uint64_t totals[stat_count]) {
+  // Sum the counts of every thread. Call it while no thread is counting.
+  for (int i = 0; i < stat_count; i++) {
+    totals[i] = 0;
+  }
+#ifdef HEMERA_STATS
+  std::lock_guard<std::mutex> lock(stat_blocks_mutex());
+  for (auto *block : stat_blocks()) {
+    for (int i = 0; i < stat_count; i++) {
+      totals[i] += block->counts[i];
+    }
+  }
+#endif
+}
+
+inline double &bvh_build_seconds() {
+  // Time spent building BVHs, summed over every build. Builds run on one thread at a time.
+  static double seconds = 0;
+  return seconds;
+}
+
+class phase_timings {
+  // Wall clock time of the phases of a run, in the order they were timed.
+ public:
+  void start() {
+    begin = std::chrono::steady_clock::now();
+  }
+
+  void stop(const std::string &phase) {
+    // Record the time since the last start() or stop() as phase.
+    auto now = std::chrono::steady_clock::now();
+    phases.push_back(std::make_pair(phase, std::chrono::duration<double>(now - begin).count()));
+    begin = now;
+  }
+
+  void add(const std::string &phase, double seconds) {
+    phases.push_back(std::make_pair(phase, seconds));
+  }
+
+  const std::vector<std::pair<std::string, double>> &all() const {
+    return phases;
+  }
+
+ private:
+  std::chrono::steady_clock::time_point begin;
+  std::vector<std::pair<std::string, double>> phases;
+};
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <cstdint>
+
+class pcg32 {
+  // PCG-XSH-RR 32 bit generator (O'Neill, "PCG: A Family of Simple Fast Space-Efficient
+  // Statistically Good Algorithms for Random Number Generation"). 64 bits of state plus a
+  // stream selector, so every (seed, stream) pair gives an independent sequence.
+ public:
+  // Default state and stream taken from the reference implementation.
+  constexpr pcg32() : state(0x853c49e6748fea9bULL), inc(0xda3e39cb94b95bdbULL) {}
+
+  pcg32(uint64_t seed_value, uint64_t stream) : state(0), inc(0) {
+    seed(seed_value, stream);
+  }
+
+  void seed(uint64_t seed_value, uint64_t stream) {
+    // Restart the generator on the given stream. Neighbouring stream ids (e.g. consecutive
+    // samples of a pixel) would start out correlated, so the initial state is scrambled
+    // through a hash of both values.
+    state = 0;
+    inc = (stream << 1u) | 1u;
+    next_uint();
+    state += mix64(seed_value ^ mix64(stream));
+    next_uint();
+  }
+
+  uint32_t next_uint() {
+    uint64_t old_state = state;
+    state = old_state * 6364136223846793005ULL + inc;
+    auto xorshifted = static_cast<uint32_t>(((old_state >> 18u) ^ old_state) >> 27u);
+    auto rot = static_cast<uint32_t>(old_state >> 59u);
+    return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+  }
+
+  double next_double() {
+    // Return a random real in [0,1) with 32 bits of resolution.
+    return next_uint() * (1.0 / 4294967296.0);
+  }
+
+  static uint64_t mix64(uint64_t x) {
+    // SplitMix64 finalizer: a cheap, well distributed 64 bit hash.
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+  }
+
+ private:
+  uint64_t state;
+  uint64_t inc;
+};
+
+inline pcg32 &thread_rng() {
+  // Each thread draws from its own generator, so random numbers never contend on shared state.
+  // The camera reseeds it for every sample, which makes a render independent of which thread
+  // traced which tile.
+  static thread_local pcg32 rng;
+  return rng;
+}
+
+#endif
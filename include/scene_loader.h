@@ -0,0 +1,660 @@
+#ifndef SCENE_LOADER_H
+#define SCENE_LOADER_H
+
+#include "common.h"
+
+#include "bvh.h"
+#include "camera.h"
+#include "constant_medium.h"
+#include "heterogeneous_medium.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "material.h"
+#include "mesh_cache.h"
+#include "mesh_loader.h"
+#include "quad.h"
+#include "sphere.h"
+#include "texture.h"
+#include "triangle.h"
+
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+
+// Loader for scene description files. A scene file holds one statement per line; everything
+// after a '#' is a comment. Names must be defined before they are used, and file names are
+// relative to the scene file.
+//
+//   camera <setting> <value>...     Any of: width <pixels>, aspect <ratio>, spp <samples>,
+//                                   depth <bounces>, background <r g b>, vfov <degrees>,
+//                                   lookfrom <x y z>, lookat <x y z>, vup <x y z>,
+//                                   defocus <degrees>, focus <distance>,
+//                                   adaptive <min samples> <threshold>. The aspect ratio
+//                                   can also be given as a fraction, like 16/9. adaptive
+//                                   stops sampling a pixel once the standard error of its
+//                                   displayed luminance is below threshold (e.g. 0.005),
+//                                   after at least min samples, and gives the samples it
+//                                   saved to noisier pixels; spp is then the average.
+//
+//   texture <name> solid <r g b>
+//   texture <name> checker <scale> <even> <odd>
+//   texture <name> image <file>
+//   texture <name> noise <scale> [bake <resolution> <corner> <opposite corner>]
+//                                   bake samples the noise once on a grid over the box, with
+//                                   resolution cells along its longest side, and interpolates
+//                                   it there: faster, but without the finest detail.
+//
+//   material <name> lambertian <albedo>
+//   material <name> metal <r g b> <fuzz>
+//   material <name> dielectric <index of refraction>
+//   material <name> diffuse_light <emission>
+//   material <name> isotropic <albedo>
+//
+// Wherever a texture is expected (albedo, emission, even, odd), either a texture name or an
+// r g b color can be given.
+//
+//   sphere <x y z> <radius> <material>
+//   moving_sphere <x y z> <x y z> <radius> <material>    From the first center to the second.
+//   quad <corner> <u> <v> <material>
+//   triangle <a> <b> <c> <material>
+//   box <corner> <opposite corner> <material>
+//   mesh <file> <material>                               An .obj or .ply triangle mesh.
+//
+// When the loader is given a cache directory, meshes are mapped from there once they have
+// been built (see mesh_cache.h).
+//
+// Shapes are added to the scene, or, between `object <name> [bvh]` and `end`, to a named
+// object that is only part of the scene where it is instanced. `bvh` builds a hierarchy over
+// the object's shapes, for objects with many of them.
+//
+//   instance <object> [material <material>] [<transform>...]
+//   medium <object> <density> <albedo>
+//   volume <corner> <opposite corner> <resolution> <albedo> noise <density> <frequency>
+//          [<threshold>]
+//
+// An instance places an object with the transforms, applied in order: translate <x y z>,
+// scale <x y z> and rotate <axis x y z> <degrees>. A medium fills an object with constant
+// density fog. A volume is a cloud in the ellipsoid inscribed in the box, with density
+// density * (turbulence(frequency * p) - threshold) / (1 - threshold), fading out towards the
+// ellipsoid's surface; it is sampled on a grid with resolution cells along the longest side
+// of the box, which must not be flat. All three can be used inside objects too.
+
+inline bool scene_error(const std::string &path, int line_number, const std::string &message) {
+  std::cerr << "ERROR: Couldn't load scene file '" << path << "'";
+  if (line_number > 0) {
+    std::cerr << ", line " << line_number;
+  }
+  std::cerr << ": " << message << ".\n";
+  return false;
+}
+
+class scene_loader {
+ public:
+  scene_loader(const std::string &scene_path, const std::string &mesh_cache_directory = "")
+      : path(scene_path), cache_directory(mesh_cache_directory), line_number(0) {
+    auto slash = path.find_last_of('/');
+    directory = slash == std::string::npos ? "" : path.substr(0, slash + 1);
+  }
+
+  bool load(hittable_list &world, camera &cam) {
+    // Read the scene into world, as one BVH over all of its objects, and set up the camera.
+    std::ifstream file(path);
+    if (!file) {
+      return scene_error(path, 0, "can't open file");
+    }
+
+    scene = make_shared<hittable_list>();
+    group = scene;
+
+    std::string line;
+    for (line_number = 1; std::getline(file, line); line_number++) {
+      auto comment = line.find('#');
+      if (comment != std::string::npos) {
+        line.erase(comment);
+      }
+
+      std::istringstream in(line);
+      std::string keyword;
+      if (!(in >> keyword)) {
+        continue;
+      }
+      if (!statement(keyword, in, cam)) {
+        return false;
+      }
+      std::string extra;
+      if (in >> extra) {
+        return error("unexpected '" + extra + "' after " + keyword);
+      }
+    }
+    line_number = 0;
+
+    if (group != scene) {
+      return error("object '" + group_name + "' has no end");
+    }
+    if (scene->objects.empty()) {
+      return error("the scene is empty");
+    }
+    world = hittable_list(make_shared<bvh_node>(*scene));
+    return true;
+  }
+
+ private:
+  std::string path;
+  std::string directory;
+  std::string cache_directory;
+  int line_number;
+
+  std::map<std::string, shared_ptr<texture>> textures;
+  std::map<std::string, shared_ptr<material>> materials;
+  std::map<std::string, shared_ptr<hittable>> objects;
+
+  shared_ptr<hittable_list> scene;
+  shared_ptr<hittable_list> group;  // Where shapes are added: the scene or an open object.
+  std::string group_name;
+  bool group_bvh = false;
+
+  bool error(const std::string &message) const {
+    return scene_error(path, line_number, message);
+  }
+
+  bool bad_arguments(const std::string &keyword) const {
+    return error("missing or invalid arguments to " + keyword);
+  }
+
+  std::string relative_path(const std::string &file) const {
+    return file.empty() || file[0] == '/' ? file : directory + file;
+  }
+
+  static vec3 read_vec3(std::istream &in) {
+    // Read three numbers; on failure in is left failed, like after any other extraction.
+    real x = 0, y = 0, z = 0;
+    in >> x >> y >> z;
+    return vec3(x, y, z);
+  }
+
+  bool statement(const std::string &keyword, std::istream &in, camera &cam) {
+    if (keyword == "camera") {
+      return camera_settings(in, cam);
+    }
+    if (keyword == "texture") {
+      return define_texture(in);
+    }
+    if (keyword == "material") {
+      return define_material(in);
+    }
+    if (keyword == "object") {
+      return begin_object(in);
+    }
+    if (keyword == "end") {
+      return end_object();
+    }
+    if (keyword == "instance") {
+      return add_instance(in);
+    }
+    if (keyword == "medium") {
+      return add_medium(in);
+    }
+    if (keyword == "volume") {
+      return add_volume(in);
+    }
+    return add_shape(keyword, in);
+  }
+
+  bool camera_settings(std::istream &in, camera &cam) {
+    std::string setting;
+    while (in >> setting) {
+      if (setting == "width") {
+        in >> cam.image_width;
+      }
+      else if (setting == "aspect") {
+        // Either a number or a width/height fraction like 16/9.
+        double width, height = 1;
+        if (in >> width && in.peek() == '/') {
+          in.get();
+          in >> height;
+        }
+        cam.aspect_ratio = width / height;
+      }
+      else if (setting == "spp") {
+        in >> cam.samples_per_pixel;
+      }
+      else if (setting == "depth") {
+        in >> cam.max_depth;
+      }
+      else if (setting == "background") {
+        cam.background = read_vec3(in);
+      }
+      else if (setting == "vfov") {
+        in >> cam.vfov;
+      }
+      else if (setting == "lookfrom") {
+        cam.lookfrom = read_vec3(in);
+      }
+      else if (setting == "lookat") {
+        cam.lookat = read_vec3(in);
+      }
+      else if (setting == "vup") {
+        cam.vup = read_vec3(in);
+      }
+      else if (setting == "defocus") {
+        in >> cam.defocus_angle;
+      }
+      else if (setting == "focus") {
+        in >> cam.focus_dist;
+      }
+      else if (setting == "adaptive") {
+        in >> cam.min_samples >> cam.adaptive_threshold;
+        cam.adaptive_sampling = true;
+      }
+      else {
+        return error("unknown camera setting '" + setting + "'");
+      }
+      if (in.fail()) {
+        return bad_arguments("camera " + setting);
+      }
+    }
+    return true;
+  }
+
+  // The argument readers below report their own errors.
+
+  bool read_texture(std::istream &in, shared_ptr<texture> &tex) {
+    // A texture argument is either the name of a texture or an r g b color.
+    std::string token;
+    if (!(in >> token)) {
+      return error("missing texture or color");
+    }
+    auto named = textures.find(token);
+    if (named != textures.end()) {
+      tex = named->second;
+      return true;
+    }
+
+    std::istringstream first(token);
+    double r, g, b;
+    if (!(first >> r)) {
+      return error("'" + token + "' is neither a texture nor a color");
+    }
+    if (!(in >> g >> b)) {
+      return error("a color needs three components");
+    }
+    tex = make_shared<solid_color>(r, g, b);
+    return true;
+  }
+
+  bool read_material(std::istream &in, shared_ptr<material> &mat) const {
+    std::string name;
+    if (!(in >> name)) {
+      return error("missing material");
+    }
+    auto named = materials.find(name);
+    if (named == materials.end()) {
+      return error("unknown material '" + name + "'");
+    }
+    mat = named->second;
+    return true;
+  }
+
+  bool read_object(std::istream &in, shared_ptr<hittable> &object) const {
+    std::string name;
+    if (!(in >> name)) {
+      return error("missing object");
+    }
+    auto named = objects.find(name);
+    if (named == objects.end()) {
+      return error("unknown object '" + name + "'");
+    }
+    object = named->second;
+    return true;
+  }
+
+  bool define_texture(std::istream &in) {
+    std::string name, type;
+    in >> name >> type;
+
+    shared_ptr<texture> tex;
+    if (type == "solid") {
+      auto c = read_vec3(in);
+      tex = make_shared<solid_color>(c.x(), c.y(), c.z());
+    }
+    else if (type == "checker") {
+      double scale;
+      shared_ptr<texture> even, odd;
+      if (!(in >> scale)) {
+        return bad_arguments("checker texture");
+      }
+      if (!read_texture(in, even) || !read_texture(in, odd)) {
+        return false;
+      }
+      tex = make_shared<checker_texture>(scale, even, odd);
+    }
+    else if (type == "image") {
+      std::string file;
+      in >> file;
+      tex = make_shared<image_texture>(relative_path(file).c_str());
+    }
+    else if (type == "noise") {
+      double scale;
+      if (!(in >> scale)) {
+        return bad_arguments("noise texture");
+      }
+      std::string option;
+      if (!(in >> option)) {
+        tex = make_shared<noise_texture>(scale);
+        in.clear();
+      }
+      else if (option == "bake") {
+        int resolution = 0;
+        in >> resolution;
+        auto a = read_vec3(in);
+        auto b = read_vec3(in);
+        if (in.fail() || resolution < 1) {
+          return bad_arguments("noise texture");
+        }
+        auto noise = make_shared<noise_texture>(scale, aabb(a, b), resolution);
+        noise->baked_noise().print(std::clog);
+        tex = noise;
+      }
+      else {
+        return error("unknown noise texture option '" + option + "'");
+      }
+    }
+    else {
+      return error("unknown texture type '" + type + "'");
+    }
+
+    if (in.fail()) {
+      return bad_arguments(type + " texture");
+    }
+    textures[name] = tex;
+    return true;
+  }
+
+  bool define_material(std::istream &in) {
+    std::string name, type;
+    in >> name >> type;
+
+    shared_ptr<material> mat;
+    if (type == "lambertian" || type == "diffuse_light" || type == "isotropic") {
+      shared_ptr<texture> tex;
+      if (!read_texture(in, tex)) {
+        return false;
+      }
+      if (type == "lambertian") {
+        mat = make_shared<lambertian>(tex);
+      }
+      else if (type == "diffuse_light") {
+        mat = make_shared<diffuse_light>(tex);
+      }
+      else {
+        mat = make_shared<isotropic>(tex);
+      }
+    }
+    else if (type == "metal") {
+      auto albedo = read_vec3(in);
+      double fuzz;
+      in >> fuzz;
+      mat = make_shared<metal>(albedo, fuzz);
+    }
+    else if (type == "dielectric") {
+      double index_of_refraction;
+      in >> index_of_refraction;
+      mat = make_shared<dielectric>(index_of_refraction);
+    }
+    else {
+      return error("unknown material type '" + type + "'");
+    }
+
+    if (in.fail()) {
+      return bad_arguments(type + " material");
+    }
+    materials[name] = mat;
+    return true;
+  }
+
+  bool add_shape(const std::string &keyword, std::istream &in) {
+    shared_ptr<hittable> shape;
+    shared_ptr<material> mat;
+
+    if (keyword == "sphere") {
+      auto center = read_vec3(in);
+      real radius;
+      if (!(in >> radius)) {
+        return bad_arguments(keyword);
+      }
+      if (!read_material(in, mat)) {
+        return false;
+      }
+      shape = make_shared<sphere>(center, radius, mat);
+    }
+    else if (keyword == "moving_sphere") {
+      auto center1 = read_vec3(in);
+      auto center2 = read_vec3(in);
+      real radius;
+      if (!(in >> radius)) {
+        return bad_arguments(keyword);
+      }
+      if (!read_material(in, mat)) {
+        return false;
+      }
+      shape = make_shared<sphere>(center1, center2, radius, mat);
+    }
+    else if (keyword == "quad" || keyword == "triangle" || keyword == "box") {
+      auto a = read_vec3(in);
+      auto b = read_vec3(in);
+      auto c = keyword == "box" ? vec3() : read_vec3(in);
+      if (in.fail()) {
+        return bad_arguments(keyword);
+      }
+      if (!read_material(in, mat)) {
+        return false;
+      }
+      if (keyword == "quad") {
+        shape = make_shared<quad>(a, b, c, mat);
+      }
+      else if (keyword == "triangle") {
+        shape = make_shared<triangle>(a, b, c, mat);
+      }
+      else {
+        shape = box(a, b, mat);
+      }
+    }
+    else if (keyword == "mesh") {
+      std::string file;
+      if (!(in >> file)) {
+        return bad_arguments(keyword);
+      }
+      if (!read_material(in, mat)) {
+        return false;
+      }
+      shared_ptr<triangle_mesh> mesh;
+      if (cache_directory.empty()) {
+        mesh_data data;
+        if (load_mesh(relative_path(file), data)) {
+          mesh = make_shared<triangle_mesh>(std::move(data), mat);
+        }
+      }
+      else {
+        mesh = load_cached_mesh(relative_path(file), cache_directory, mat);
+      }
+      if (!mesh) {
+        return error("can't load mesh '" + file + "'");
+      }
+      mesh->print(std::clog);
+      shape = mesh;
+    }
+    else {
+      return error("unknown statement '" + keyword + "'");
+    }
+
+    group->add(shape);
+    return true;
+  }
+
+  bool begin_object(std::istream &in) {
+    if (group_name != "") {
+      return error("object '" + group_name + "' has no end before the next object");
+    }
+    if (!(in >> group_name)) {
+      return bad_arguments("object");
+    }
+    std::string option;
+    group_bvh = (in >> option) && option == "bvh";
+    if (option != "" && !group_bvh) {
+      return error("unknown object option '" + option + "'");
+    }
+    group = make_shared<hittable_list>();
+    return true;
+  }
+
+  bool end_object() {
+    if (group_name == "") {
+      return error("end without an object");
+    }
+    if (group->objects.empty()) {
+      return error("object '" + group_name + "' is empty");
+    }
+
+    // An object of one shape is that shape itself.
+    shared_ptr<hittable> object = group;
+    if (group_bvh) {
+      object = make_shared<bvh_node>(*group);
+    }
+    else if (group->objects.size() == 1) {
+      object = group->objects[0];
+    }
+    objects[group_name] = object;
+
+    group = scene;
+    group_name = "";
+    return true;
+  }
+
+  bool add_instance(std::istream &in) {
+    shared_ptr<hittable> object;
+    if (!read_object(in, object)) {
+      return false;
+    }
+
+    shared_ptr<material> mat;
+    affine_transform transform;
+    bool transformed = false;
+    std::string operation;
+    while (in >> operation) {
+      if (operation == "material") {
+        if (!read_material(in, mat)) {
+          return false;
+        }
+        continue;
+      }
+
+      affine_transform step;
+      if (operation == "translate") {
+        step = affine_transform::translation(read_vec3(in));
+      }
+      else if (operation == "scale") {
+        step = affine_transform::scaling(read_vec3(in));
+      }
+      else if (operation == "rotate") {
+        auto axis = read_vec3(in);
+        double degrees;
+        in >> degrees;
+        step = affine_transform::rotation(axis, degrees);
+      }
+      else {
+        return error("unknown transform '" + operation + "'");
+      }
+      if (in.fail()) {
+        return bad_arguments(operation);
+      }
+      transform = step * transform;
+      transformed = true;
+    }
+
+    if (transformed || mat) {
+      object = make_shared<instance>(object, transform, mat);
+    }
+    group->add(object);
+    return true;
+  }
+
+  bool add_medium(std::istream &in) {
+    shared_ptr<hittable> boundary;
+    double density;
+    shared_ptr<texture> albedo;
+    if (!read_object(in, boundary)) {
+      return false;
+    }
+    if (!(in >> density)) {
+      return bad_arguments("medium");
+    }
+    if (!read_texture(in, albedo)) {
+      return false;
+    }
+    group->add(make_shared<constant_medium>(boundary, density, albedo));
+    return true;
+  }
+
+  bool add_volume(std::istream &in) {
+    auto a = read_vec3(in);
+    auto b = read_vec3(in);
+    int resolution = 0;
+    shared_ptr<texture> albedo;
+    if (!(in >> resolution) || resolution < 1) {
+      return bad_arguments("volume");
+    }
+    if (!read_texture(in, albedo)) {
+      return false;
+    }
+
+    std::string field;
+    double density, frequency, threshold = 0;
+    if (!(in >> field >> density >> frequency)) {
+      return bad_arguments("volume");
+    }
+    if (field != "noise") {
+      return error("unknown volume field '" + field + "'");
+    }
+    if (!(in >> threshold)) {
+      in.clear();
+    }
+    if (threshold >= 1) {
+      return bad_arguments("volume");
+    }
+    for (int axis = 0; axis < 3; axis++) {
+      // The grid's cells and the falloff are both scaled by the box's size along each axis.
+      if (!(fabs(b[axis] - a[axis]) > 0)) {
+        return bad_arguments("volume");
+      }
+    }
+
+    aabb box(a, b);
+    auto center = 0.5 * (a + b);
+    auto inv_half = vec3(2 / box.x.size(), 2 / box.y.size(), 2 / box.z.size());
+    auto noise = make_shared<perlin>();
+    auto field_at = [=](const point3 &p) {
+      auto offset = (p - center) * inv_half;
+      auto falloff = 1 - offset.length_squared();
+      if (falloff <= 0) {
+        return 0.0;
+      }
+      auto turbulence = noise->turb(frequency * p, 7);
+      return density * falloff * fmax(0.0, turbulence - threshold) / (1 - threshold);
+    };
+    auto grid = make_shared<density_grid>(box, resolution, field_at);
+    grid->print(std::clog);
+    group->add(make_shared<heterogeneous_medium>(grid, albedo));
+    return true;
+  }
+};
+
+inline bool load_scene(const std::string &path,
+                       hittable_list &world,
+                       camera &cam,
+                       const std::string &mesh_cache_directory = "") {
+  return scene_loader(path, mesh_cache_directory).load(world, cam);
+}
+
+#endif
@@ -0,0 +1,406 @@
+#ifndef SIMD_H
+#define SIMD_H
+// Minimal packed float and int types for the vectorized kernels. They map to AVX (8 lanes) or
+// SSE (4 lanes) when the compiler targets them, and to plain arrays otherwise, so every kernel
+// can be written once against simd_float and simd_int.
+
+#if defined(__AVX__)
+#  include <immintrin.h>
+#elif defined(__SSE2__)
+#  include <emmintrin.h>
+#endif
+
+#if defined(__AVX2__)
+#  define HEMERA_SIMD_WIDTH 8
+#elif defined(__SSE2__)
+#  define HEMERA_SIMD_WIDTH 4
+#else
+#  define HEMERA_SIMD_WIDTH 4
+#endif
+
+const int simd_width = HEMERA_SIMD_WIDTH;
+
+#if defined(__AVX2__)
+
+struct simd_float {
+  __m256 v;
+
+  simd_float() {}
+  simd_float(__m256 value) : v(value) {}
+  explicit simd_float(float value) : v(_mm256_set1_ps(value)) {}
+
+  static simd_float load(const float *p) {
+    return _mm256_loadu_ps(p);
+  }
+  void store(float *p) const {
+    _mm256_storeu_ps(p, v);
+  }
+};
+
+inline simd_float operator+(simd_float a, simd_float b) {
+  return _mm256_add_ps(a.v, b.v);
+}
+inline simd_float operator-(simd_float a, simd_float b) {
+  return _mm256_sub_ps(a.v, b.v);
+}
+inline simd_float operator*(simd_float a, simd_float b) {
+  return _mm256_mul_ps(a.v, b.v);
+}
+inline simd_float simd_abs(simd_float a) {
+  return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v);
+}
+inline simd_float simd_min(simd_float a, simd_float b) {
+  // Returns b in any lane where a is NaN.
+  return _mm256_min_ps(a.v, b.v);
+}
+inline simd_float simd_max(simd_float a, simd_float b) {
+  // Returns b in any lane where a is NaN.
+  return _mm256_max_ps(a.v, b.v);
+}
+inline int less_equal_mask(simd_float a, simd_float b) {
+  // Bit i is set when lane i of a is <= lane i of b.
+  return _mm256_movemask_ps(_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ));
+}
+
+struct simd_int {
+  __m256i v;
+
+  simd_int() {}
+  simd_int(__m256i value) : v(value) {}
+  explicit simd_int(int value) : v(_mm256_set1_epi32(value)) {}
+
+  static simd_int load(const int *p) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+  }
+};
+
+inline simd_int operator+(simd_int a, simd_int b) {
+  return _mm256_add_epi32(a.v, b.v);
+}
+inline simd_int operator&(simd_int a, simd_int b) {
+  return _mm256_and_si256(a.v, b.v);
+}
+inline simd_int operator^(simd_int a, simd_int b) {
+  return _mm256_xor_si256(a.v, b.v);
+}
+inline simd_int gather(const int *base, simd_int index) {
+  // Lane i is base[index[i]].
+  return _mm256_i32gather_epi32(base, index.v, sizeof(int));
+}
+inline simd_float gather(const float *base, simd_int index) {
+  return _mm256_i32gather_ps(base, index.v, sizeof(float));
+}
+
+#elif defined(__SSE2__)
+
+struct simd_float {
+  __m128 v;
+
+  simd_float() {}
+  simd_float(__m128 value) : v(value) {}
+  explicit simd_float(float value) : v(_mm_set1_ps(value)) {}
+
+  static simd_float load(const float *p) {
+    return _mm_loadu_ps(p);
+  }
+  void store(float *p) const {
+    _mm_storeu_ps(p, v);
+  }
+};
+
+inline simd_float operator+(simd_float a, simd_float b) {
+  return _mm_add_ps(a.v, b.v);
+}
+inline simd_float operator-(simd_float a, simd_float b) {
+  return _mm_sub_ps(a.v, b.v);
+}
+inline simd_float operator*(simd_float a, simd_float b) {
+  return _mm_mul_ps(a.v, b.v);
+}
+inline simd_float simd_abs(simd_float a) {
+  return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v);
+}
+inline simd_float simd_min(simd_float a, simd_float b) {
+  // Returns b in any lane where a is NaN.
+  return _mm_min_ps(a.v, b.v);
+}
+inline simd_float simd_max(simd_float a, simd_float b) {
+  // Returns b in any lane where a is NaN.
+  return _mm_max_ps(a.v, b.v);
+}
+inline int less_equal_mask(simd_float a, simd_float b) {
+  // Bit i is set when lane i of a is <= lane i of b.
+  return _mm_movemask_ps(_mm_cmple_ps(a.v, b.v));
+}
+
+struct simd_int {
+  __m128i v;
+
+  simd_int() {}
+  simd_int(__m128i value) : v(value) {}
+  explicit simd_int(int value) : v(_mm_set1_epi32(value)) {}
+
+  static simd_int load(const int *p) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+  }
+};
+
+inline simd_int operator+(simd_int a, simd_int b) {
+  return _mm_add_epi32(a.v, b.v);
+}
+inline simd_int operator&(simd_int a, simd_int b) {
+  return _mm_and_si128(a.v, b.v);
+}
+inline simd_int operator^(simd_int a, simd_int b) {
+  return _mm_xor_si128(a.v, b.v);
+}
+inline simd_int gather(const int *base, simd_int index) {
+  // Lane i is base[index[i]]. SSE has no gather instruction, so the lanes are loaded one by one.
+  alignas(16) int i[4];
+  _mm_store_si128(reinterpret_cast<__m128i *>(i), index.v);
+  return _mm_setr_epi32(base[i[0]], base[i[1]], base[i[2]], base[i[3]]);
+}
+inline simd_float gather(const float *base, simd_int index) {
+  alignas(16) int i[4];
+  _mm_store_si128(reinterpret_cast<__m128i *>(i), index.v);
+  return _mm_setr_ps(base[i[0]], base[i[1]], base[i[2]], base[i[3]]);
+}
+
+#else
+
+struct simd_float {
+  float v[simd_width];
+
+  simd_float() {}
+  explicit simd_float(float value) {
+    for (int i = 0; i < simd_width; i++) {
+      v[i] = value;
+    }
+  }
+
+  static simd_float load(const float *p) {
+    simd_float result;
+    for (int i = 0; i < simd_width; i++) {
+      result.v[i] = p[i];
+    }
+    return result;
+  }
+  void store(float *p) const {
+    for (int i = 0; i < simd_width; i++) {
+      p[i] = v[i];
+    }
+  }
+};
+
+#  define HEMERA_SIMD_LANEWISE(expression) \
+    simd_float result;                     \
+    for (int i = 0; i < simd_width; i++) { \
+      result.v[i] = expression;            \
+    }                                      \
+    return result;
+
+inline simd_float operator+(simd_float a, simd_float b) {
+  HEMERA_SIMD_LANEWISE(a.v[i] + b.v[i])
+}
+inline simd_float operator-(simd_float a, simd_float b) {
+  HEMERA_SIMD_LANEWISE(a.v[i] - b.v[i])
+}
+inline simd_float operator*(simd_float a, simd_float b) {
+  HEMERA_SIMD_LANEWISE(a.v[i] * b.v[i])
+}
+inline simd_float simd_abs(simd_float a) {
+  HEMERA_SIMD_LANEWISE(a.v[i] < 0 ? -a.v[i] : a.v[i])
+}
+inline simd_float simd_min(simd_float a, simd_float b) {
+  // Returns b in any lane where a is NaN, like the SSE instruction.
+  HEMERA_SIMD_LANEWISE(a.v[i] < b.v[i] ? a.v[i] : b.v[i])
+}
+inline simd_float simd_max(simd_float a, simd_float b) {
+  // Returns b in any lane where a is NaN, like the SSE instruction.
+  HEMERA_SIMD_LANEWISE(a.v[i] > b.v[i] ? a.v[i] : b.v[i])
+}
+inline int less_equal_mask(simd_float a, simd_float b) {
+  int mask = 0;
+  for (int i = 0; i < simd_width; i++) {
+    mask |= (a.v[i] <= b.v[i]) << i;
+  }
+  return mask;
+}
+
+struct simd_int {
+  int v[simd_width];
+
+  simd_int() {}
+  explicit simd_int(int value) {
+    for (int i = 0; i < simd_width; i++) {
+      v[i] = value;
+    }
+  }
+
+  static simd_int load(const int *p) {
+    simd_int result;
+    for (int i = 0; i < simd_width; i++) {
+      result.v[i] = p[i];
+    }
+    return result;
+  }
+};
+
+#  define HEMERA_SIMD_INT_LANEWISE(expression) \
+    simd_int result;                           \
+    for (int i = 0; i < simd_width; i++) {     \
+      result.v[i] = expression;                \
+    }                                          \
+    return result;
+
+inline simd_int operator+(simd_int a, simd_int b) {
+  HEMERA_SIMD_INT_LANEWISE(a.v[i] + b.v[i])
+}
+inline simd_int operator&(simd_int a, simd_int b) {
+  HEMERA_SIMD_INT_LANEWISE(a.v[i] & b.v[i])
+}
+inline simd_int operator^(simd_int a, simd_int b) {
+  HEMERA_SIMD_INT_LANEWISE(a.v[i] ^ b.v[i])
+}
+inline simd_int gather(const int *base, simd_int index) {
+  // Lane i is base[index[i]].
+  HEMERA_SIMD_INT_LANEWISE(base[index.v[i]])
+}
+inline simd_float gather(const float *base, simd_int index) {
+  HEMERA_SIMD_LANEWISE(base[index.v[i]])
+}
+
+#  undef HEMERA_SIMD_INT_LANEWISE
+#  undef HEMERA_SIMD_LANEWISE
+
+#endif
+
+// Lanes holding the three components of a vec3. scalar_lanes<T> is three plain scalars;
+// simd_lanes<T> is four lanes that map to an SSE register for float and an AVX one for double,
+// falling back to scalar_lanes<T>. The fourth lane is padding: set() zeroes it but broadcast()
+// fills it like the others, and the lanewise operators carry it along, so it can hold any
+// value, even NaN after a division. Nothing may read it, e.g. to sum the lanes of a dot.
+
+template <typename T>
+struct scalar_lanes {
+  T v[3];
+
+  static scalar_lanes set(T x, T y, T z) {
+    return scalar_lanes{{x, y, z}};
+  }
+  static scalar_lanes broadcast(T value) {
+    return scalar_lanes{{value, value, value}};
+  }
+  T get(int i) const {
+    return v[i];
+  }
+  T *data() {
+    return v;
+  }
+};
+
+#define HEMERA_SCALAR_LANES(op)                                                       \
+  template <typename T>                                                               \
+  inline scalar_lanes<T> operator op(scalar_lanes<T> a, scalar_lanes<T> b) {          \
+    return scalar_lanes<T>{{a.v[0] op b.v[0], a.v[1] op b.v[1], a.v[2] op b.v[2]}};   \
+  }
+
+HEMERA_SCALAR_LANES(+)
+HEMERA_SCALAR_LANES(-)
+HEMERA_SCALAR_LANES(*)
+HEMERA_SCALAR_LANES(/)
+
+#undef HEMERA_SCALAR_LANES
+
+template <typename T>
+struct simd_lanes_of {
+  typedef scalar_lanes<T> type;
+};
+
+template <typename T>
+using simd_lanes = typename simd_lanes_of<T>::type;
+
+#if defined(__SSE2__)
+
+struct simd_float4 {
+  __m128 v;
+
+  static simd_float4 set(float x, float y, float z) {
+    return simd_float4{_mm_setr_ps(x, y, z, 0)};
+  }
+  static simd_float4 broadcast(float value) {
+    return simd_float4{_mm_set1_ps(value)};
+  }
+  float get(int i) const {
+    return v[i];
+  }
+  float *data() {
+    // The vector types may alias their scalars, so the lanes can be addressed directly.
+    return reinterpret_cast<float *>(&v);
+  }
+};
+
+inline simd_float4 operator+(simd_float4 a, simd_float4 b) {
+  return simd_float4{_mm_add_ps(a.v, b.v)};
+}
+inline simd_float4 operator-(simd_float4 a, simd_float4 b) {
+  return simd_float4{_mm_sub_ps(a.v, b.v)};
+}
+inline simd_float4 operator*(simd_float4 a, simd_float4 b) {
+  return simd_float4{_mm_mul_ps(a.v, b.v)};
+}
+inline simd_float4 operator/(simd_float4 a, simd_float4 b) {
+  return simd_float4{_mm_div_ps(a.v, b.v)};
+}
+
+template <>
+struct simd_lanes_of<float> {
+  typedef simd_float4 type;
+};
+
+#endif
+
+#if defined(__AVX__)
+
+// C++11 containers don't honour alignments beyond 16 bytes, so the double lanes are declared
+// 16 byte aligned, which makes the compiler use unaligned moves.
+typedef __m256d simd_m256d_align16 __attribute__((aligned(16)));
+
+struct simd_double4 {
+  simd_m256d_align16 v;
+
+  static simd_double4 set(double x, double y, double z) {
+    return simd_double4{_mm256_setr_pd(x, y, z, 0)};
+  }
+  static simd_double4 broadcast(double value) {
+    return simd_double4{_mm256_set1_pd(value)};
+  }
+  double get(int i) const {
+    return v[i];
+  }
+  double *data() {
+    return reinterpret_cast<double *>(&v);
+  }
+};
+
+inline simd_double4 operator+(simd_double4 a, simd_double4 b) {
+  return simd_double4{_mm256_add_pd(a.v, b.v)};
+}
+inline simd_double4 operator-(simd_double4 a, simd_double4 b) {
+  return simd_double4{_mm256_sub_pd(a.v, b.v)};
+}
+inline simd_double4 operator*(simd_double4 a, simd_double4 b) {
+  return simd_double4{_mm256_mul_pd(a.v, b.v)};
+}
+inline simd_double4 operator/(simd_double4 a, simd_double4 b) {
+  return simd_double4{_mm256_div_pd(a.v, b.v)};
+}
+
+template <>
+struct simd_lanes_of<double> {
+  typedef simd_double4 type;
+};
+
+#endif
+
+#endif
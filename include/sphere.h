@@ -7,14 +7,14 @@
 class sphere : public hittable {
  public:
   /* Stationary Sphere. */
-  sphere(point3 _center, double _radius, shared_ptr<material> _material)
+  sphere(point3 _center, real _radius, shared_ptr<material> _material)
       : center1(_center), radius(_radius), mat(_material), is_moving(false) {
     auto rvec = vec3(radius, radius, radius);
     bbox = aabb(center1 - rvec, center1 + rvec);
   }
 
   /* Moving Sphere. */
-  sphere(point3 _center1, point3 _center2, double _radius, shared_ptr<material> _material)
+  sphere(point3 _center1, point3 _center2, real _radius, shared_ptr<material> _material)
       : center1(_center1), radius(_radius), mat(_material), is_moving(true) {
 
     auto rvec = vec3(radius, radius, radius);
@@ -26,57 +26,191 @@ class sphere : public hittable {
   }
 
   bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
-    point3 center = is_moving ? sphere_center(r.time()) : center1;
-    vec3 oc = r.origin() - center;
-    auto a = r.direction().length_squared();
-    auto half_b = dot(oc, r.direction());
-    auto c = oc.length_squared() - radius * radius;
-    auto discriminant = half_b * half_b - a * c;
-    if (discriminant < 0) {
+    HEMERA_COUNT(stat_sphere_tests);
+    real root;
+    if (!nearest_root(r, ray_t, root)) {
       return false;
     }
 
-    auto sqrtd = sqrt(discriminant);
-
-    // Find the nearest root that lies in the acceptable range.
-    auto root = (-half_b - sqrtd) / a;
-    if (!ray_t.surrounds(root)) {
-      root = (-half_b + sqrtd) / a;
-      if (!ray_t.surrounds(root)) {
-        return false;
-      }
-    }
-
+    HEMERA_COUNT(stat_sphere_hits);
     rec.t = root;
+    rec.object = this;
+    return true;
+  }
+
+  void finalize(const ray &r, hit_record &rec) const override {
+    point3 center = is_moving ? sphere_center(r.time()) : center1;
     rec.p = r.at(rec.t);
-    rec.normal = (rec.p - center) / radius;
     vec3 outward_normal = (rec.p - center) / radius;
     rec.set_face_normal(r, outward_normal);
     get_sphere_uv(outward_normal, rec.u, rec.v);
-    rec.mat = mat;
+    rec.mat = mat.get();
 
-    return true;
+    // u spans a circle of latitude and v half a great circle, so the geometric mean of their
+    // lengths, pi r sqrt(2 sin(theta)), is taken as one texture unit.
+    auto sin_theta = sqrt(outward_normal.x() * outward_normal.x() +
+                          outward_normal.z() * outward_normal.z());
+    rec.uv_density = 1 / (pi * radius * sqrt(2 * fmax(sin_theta, 1e-4)));
+  }
+
+  int hit_packet(const ray_packet &packet,
+                 real t_min,
+                 real t_max[],
+                 hit_record rec[],
+                 int active) const override {
+    // Solve the quadratic for every lane at once (the loop is written branch free so it
+    // vectorizes), then record the lanes that hit. Lanes that miss get a root
+    // of -infinity, which no ray interval contains.
+    HEMERA_COUNT_N(stat_sphere_tests, lane_count(active));
+    const int n = ray_packet::size;
+    real root[n];
+
+    for (int k = 0; k < n; k++) {
+      real time = is_moving ? packet.time[k] : 0;
+      real ocx = packet.origin[0][k] - (center1.x() + time * center_vec.x());
+      real ocy = packet.origin[1][k] - (center1.y() + time * center_vec.y());
+      real ocz = packet.origin[2][k] - (center1.z() + time * center_vec.z());
+      real dx = packet.direction[0][k], dy = packet.direction[1][k];
+      real dz = packet.direction[2][k];
+
+      real a = dx * dx + dy * dy + dz * dz;
+      real half_b = ocx * dx + ocy * dy + ocz * dz;
+      real lx = ocx - half_b / a * dx, ly = ocy - half_b / a * dy, lz = ocz - half_b / a * dz;
+      real discriminant = a * (radius * radius - (lx * lx + ly * ly + lz * lz));
+      real sqrtd = sqrt(discriminant > 0 ? discriminant : 0);
+
+      real near_root = (-half_b - sqrtd) / a;
+      real far_root = (-half_b + sqrtd) / a;
+      bool near_ok = t_min < near_root && near_root < t_max[k];
+      bool far_ok = t_min < far_root && far_root < t_max[k];
+      bool found = discriminant >= 0 && (near_ok || far_ok);
+      root[k] = found ? (near_ok ? near_root : far_root) : -infinity;
+    }
+
+    int hits = 0;
+    for (int k = 0; k < n; k++) {
+      if (!(active & (1 << k)) || root[k] == -infinity) {
+        continue;
+      }
+      rec[k].t = root[k];
+      rec[k].object = this;
+      t_max[k] = root[k];
+      hits |= 1 << k;
+    }
+    HEMERA_COUNT_N(stat_sphere_hits, lane_count(hits));
+    return hits;
   }
 
   aabb bounding_box() const override {
     return bbox;
   }
 
+  bool hit_interval(const ray &r, interval &inside) const override {
+    real near_root, far_root;
+    if (!roots(r, near_root, far_root) || near_root == far_root) {
+      return false;
+    }
+    inside = interval(near_root, far_root);
+    return true;
+  }
+
+  double pdf_value(const point3 &origin, const vec3 &direction) const override {
+    // Directions are sampled uniformly inside the cone the sphere subtends from the origin,
+    // or over all directions when the origin is inside the sphere.
+    real root;
+    if (!nearest_root(ray(origin, direction, 0), interval(0.001, infinity), root)) {
+      return 0;
+    }
+
+    auto distance_squared = (center1 - origin).length_squared();
+    if (distance_squared <= radius * radius) {
+      return 1 / (4 * pi);
+    }
+    auto cos_theta_max = sqrt(1 - radius * radius / distance_squared);
+    return 1 / (2 * pi * (1 - cos_theta_max));
+  }
+
+  vec3 random(const point3 &origin) const override {
+    vec3 direction = center1 - origin;
+    auto distance_squared = direction.length_squared();
+    if (distance_squared <= radius * radius) {
+      return random_unit_vector();
+    }
+
+    // Pick a direction in the cone around the z axis, then rotate z onto the sphere center.
+    auto cos_theta_max = sqrt(1 - radius * radius / distance_squared);
+    auto z = 1 + random_double() * (cos_theta_max - 1);
+    auto phi = 2 * pi * random_double();
+    auto sin_theta = sqrt(1 - z * z);
+
+    vec3 axis_w = unit_vector(direction);
+    vec3 a = fabs(axis_w.x()) > 0.9 ? vec3(0, 1, 0) : vec3(1, 0, 0);
+    vec3 axis_v = unit_vector(cross(axis_w, a));
+    vec3 axis_u = cross(axis_w, axis_v);
+    return sin_theta * cos(phi) * axis_u + sin_theta * sin(phi) * axis_v + z * axis_w;
+  }
+
+  void gather_lights(std::vector<const hittable *> &lights) const override {
+    // Moving spheres would need the time of the ray to be sampled; they are only hit by chance.
+    if (mat->is_emissive() && !is_moving) {
+      lights.push_back(this);
+    }
+  }
+
  private:
   point3 center1;
-  double radius;
+  real radius;
   shared_ptr<material> mat;
   bool is_moving;
   vec3 center_vec;
   aabb bbox;
 
-  point3 sphere_center(double time) const {
+  bool roots(const ray &r, real &near_root, real &far_root) const {
+    // Where the ray's line meets the sphere, if it does.
+    point3 center = is_moving ? sphere_center(r.time()) : center1;
+    vec3 oc = r.origin() - center;
+    auto a = r.direction().length_squared();
+    auto half_b = dot(oc, r.direction());
+    // half_b^2 - a * c cancels catastrophically when the ray starts far away compared to the
+    // radius, which speckles float renders. The same value comes from the distance between the
+    // center and the ray's line (Haines et al., "Precision Improvements for Ray/Sphere
+    // Intersection", Ray Tracing Gems).
+    vec3 l = oc - (half_b / a) * r.direction();
+    auto discriminant = a * (radius * radius - l.length_squared());
+    if (discriminant < 0) {
+      return false;
+    }
+
+    auto sqrtd = sqrt(discriminant);
+    near_root = (-half_b - sqrtd) / a;
+    far_root = (-half_b + sqrtd) / a;
+    return true;
+  }
+
+  bool nearest_root(const ray &r, interval ray_t, real &root) const {
+    // The nearest root inside ray_t. hit() counts around it; pdf_value() calls it directly.
+    real near_root, far_root;
+    if (!roots(r, near_root, far_root)) {
+      return false;
+    }
+
+    root = near_root;
+    if (!ray_t.surrounds(root)) {
+      root = far_root;
+      if (!ray_t.surrounds(root)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  point3 sphere_center(real time) const {
     // Lineraly interpolate from center1 to center2 according to time, where t=0 yields
     // Center1, and t=1 yields Center2
     return center1 + time * center_vec;
   }
 
-  static void get_sphere_uv(const point3 &p, double &u, double &v) {
+  static void get_sphere_uv(const point3 &p, real &u, real &v) {
     // p: a given point on the sphere of radius one, centered at the origin.
     // u: returned value [0,1] of angle around the Y axis from X=-1.
     // v: returned value [0,1] of angle from Y=-1 to Y=+1.
@@ -2,6 +2,7 @@
 #define TEXTURE_H
 
 #include "common.h"
+#include "mip_map.h"
 #include "perlin.h"
 #include "uv_image.h"
 
@@ -10,6 +11,12 @@ class texture {
   virtual ~texture() = default;
 
   virtual color value(double u, double v, const point3 &p) const = 0;
+
+  virtual color filtered_value(double u, double v, const point3 &p, double) const {
+    // The value averaged over a footprint of the given width in texture coordinates. Textures
+    // that don't alias, or can't filter, return their value at (u, v).
+    return value(u, v, p);
+  }
 };
 
 class solid_color : public texture {
@@ -37,13 +44,19 @@ class checker_texture : public texture {
         odd(make_shared<solid_color>(c2)) {}
 
   color value(double u, double v, const point3 &p) const override {
+    return filtered_value(u, v, p, 0);
+  }
+
+  color filtered_value(double u, double v, const point3 &p, double footprint) const override {
+    // The cells are solid in space, so only the textures inside them are filtered.
     auto xInteger = int(std::floor(inv_scale * p.x()));
     auto yInteger = int(std::floor(inv_scale * p.y()));
     auto zInteger = int(std::floor(inv_scale * p.z()));
 
     bool isEven = (xInteger + yInteger + zInteger) % 2 == 0;
 
-    return isEven ? even->value(u, v, p) : odd->value(u, v, p);
+    return isEven ? even->filtered_value(u, v, p, footprint)
+                  : odd->filtered_value(u, v, p, footprint);
   }
 
  private:
@@ -54,11 +67,18 @@ class checker_texture : public texture {
 
 class image_texture : public texture {
  public:
-  image_texture(const char *filename) : image(filename) {}
+  image_texture(const char *filename) {
+    // The 8-bit image is only needed to build the mip map.
+    image.build(uv_image(filename));
+  }
 
   color value(double u, double v, const point3 &p) const override {
+    return filtered_value(u, v, p, 0);
+  }
+
+  color filtered_value(double u, double v, const point3 &, double footprint) const override {
     // If there's no image data, return solid cyan as a debugging aid.
-    if (image.height() <= 0) {
+    if (image.empty()) {
       std::cerr << "error in texture \n";
       return color(0, 1, 1);
     }
@@ -66,17 +86,11 @@ class image_texture : public texture {
     // Clamp input texture coordinates to [0,1] x [1.0]
     u = interval(0, 1).clamp(u);
     v = 1.0 - interval(0, 1).clamp(v);  // Flip V to image coordinates
-
-    auto i = int(u * image.width());
-    auto j = int(v * image.height());
-    auto pixel = image.pixel_data(i, j);
-
-    auto color_scale = 1.0 / 255.0;
-    return color(color_scale * pixel[0], color_scale * pixel[1], color_scale * pixel[2]);
+    return image.sample(u, v, footprint);
   }
 
  private:
-  uv_image image;
+  mip_map image;
 };
 
 class noise_texture : public texture {
@@ -85,12 +99,27 @@ class noise_texture : public texture {
 
   noise_texture(double sc) : scale(sc) {}
 
+  noise_texture(double sc, const aabb &bake_box, int resolution) : scale(sc) {
+    // Bake the turbulence inside bake_box to a grid; points outside it still evaluate it.
+    baked.bake(noise, bake_box, resolution, depth);
+  }
+
   color value(double u, double v, const point3 &p) const override {
-    return color(1, 1, 1) * 0.5 * (1 + sin(scale * p.z() + 10 * noise.turb(p, 7)));
+    double turbulence;
+    if (!baked.lookup(p, turbulence)) {
+      turbulence = noise.turb(p, depth);
+    }
+    return color(1, 1, 1) * 0.5 * (1 + sin(scale * p.z() + 10 * turbulence));
+  }
+
+  const noise_volume &baked_noise() const {
+    return baked;
   }
 
  private:
+  static const int depth = 7;  // Octaves of turbulence.
   perlin noise;
+  noise_volume baked;
   double scale;
 };
 
@@ -0,0 +1,144 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class thread_pool {
+  // A fixed set of worker threads with one task deque per worker. Workers run their own deque
+  // in submission order, from the front, and once it runs dry steal from the back of the other
+  // deques, so uneven tasks (e.g. tiles covering a glass sphere vs. empty sky) balance
+  // themselves out while the owners still work through the early submissions first.
+ public:
+  explicit thread_pool(int thread_count = 0)
+      : queued(0), pending(0), next_queue(0), stopping(false) {
+    if (thread_count <= 0) {
+      thread_count = static_cast<int>(std::thread::hardware_concurrency());
+    }
+    if (thread_count <= 0) {
+      thread_count = 1;
+    }
+
+    for (int i = 0; i < thread_count; i++) {
+      queues.emplace_back(new task_queue());
+    }
+    for (int i = 0; i < thread_count; i++) {
+      workers.emplace_back(&thread_pool::worker_loop, this, i);
+    }
+  }
+
+  ~thread_pool() {
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex);
+      stopping = true;
+    }
+    work_available.notify_all();
+    for (auto &worker : workers) {
+      worker.join();
+    }
+  }
+
+  thread_pool(const thread_pool &) = delete;
+  thread_pool &operator=(const thread_pool &) = delete;
+
+  int size() const {
+    return static_cast<int>(workers.size());
+  }
+
+  void submit(std::function<void()> task) {
+    // Queue a task, spreading submissions round-robin over the worker deques.
+    // The counts go up before the task is visible, so a worker that picks it up at once can
+    // never take them below zero.
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex);
+      queued++;
+      pending++;
+    }
+    auto &queue = *queues[next_queue++ % queues.size()];
+    {
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      queue.tasks.push_back(std::move(task));
+    }
+    work_available.notify_one();
+  }
+
+  void wait() {
+    // Block until every submitted task has finished running.
+    std::unique_lock<std::mutex> lock(sleep_mutex);
+    all_done.wait(lock, [this] { return pending == 0; });
+  }
+
+ private:
+  struct task_queue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  std::vector<std::unique_ptr<task_queue>> queues;
+  std::vector<std::thread> workers;
+
+  std::mutex sleep_mutex;
+  std::condition_variable work_available;
+  std::condition_variable all_done;
+  std::atomic<size_t> queued;  // Tasks sitting in a deque, not yet picked up by a worker.
+  size_t pending;              // Submitted tasks that have not finished (guarded by sleep_mutex).
+  size_t next_queue;
+  bool stopping;
+
+  bool pop_local(size_t index, std::function<void()> &task) {
+    auto &queue = *queues[index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) {
+      return false;
+    }
+    task = std::move(queue.tasks.front());
+    queue.tasks.pop_front();
+    queued--;
+    return true;
+  }
+
+  bool steal(size_t thief, std::function<void()> &task) {
+    for (size_t offset = 1; offset < queues.size(); offset++) {
+      auto &queue = *queues[(thief + offset) % queues.size()];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (!queue.tasks.empty()) {
+        task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+        queued--;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void worker_loop(size_t index) {
+    while (true) {
+      std::function<void()> task;
+
+      if (pop_local(index, task) || steal(index, task)) {
+        task();
+
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        if (--pending == 0) {
+          all_done.notify_all();
+        }
+        continue;
+      }
+
+      // Nothing to run anywhere; sleep until a task is queued or the pool shuts down.
+      std::unique_lock<std::mutex> lock(sleep_mutex);
+      work_available.wait(lock, [this] { return stopping || queued > 0; });
+      if (stopping && queued == 0) {
+        return;
+      }
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,138 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "common.h"
+
+#include "aabb.h"
+
+class affine_transform {
+  // A 3x4 matrix: a linear part in the first three columns followed by a translation. Points
+  // are moved by the translation, vectors are not.
+ public:
+  real m[3][4];
+
+  affine_transform() : m{{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}} {}
+
+  static affine_transform translation(const vec3 &offset) {
+    affine_transform t;
+    for (int i = 0; i < 3; i++) {
+      t.m[i][3] = offset[i];
+    }
+    return t;
+  }
+
+  static affine_transform scaling(const vec3 &factors) {
+    affine_transform t;
+    for (int i = 0; i < 3; i++) {
+      t.m[i][i] = factors[i];
+    }
+    return t;
+  }
+
+  static affine_transform rotation(const vec3 &axis, double degrees) {
+    // Counterclockwise rotation about the axis, looking down it towards the origin.
+    auto a = unit_vector(axis);
+    auto radians = degrees_to_radians(degrees);
+    auto c = cos(radians), s = sin(radians), k = 1 - c;
+
+    affine_transform t;
+    t.m[0][0] = c + a.x() * a.x() * k;
+    t.m[0][1] = a.x() * a.y() * k - a.z() * s;
+    t.m[0][2] = a.x() * a.z() * k + a.y() * s;
+    t.m[1][0] = a.y() * a.x() * k + a.z() * s;
+    t.m[1][1] = c + a.y() * a.y() * k;
+    t.m[1][2] = a.y() * a.z() * k - a.x() * s;
+    t.m[2][0] = a.z() * a.x() * k - a.y() * s;
+    t.m[2][1] = a.z() * a.y() * k + a.x() * s;
+    t.m[2][2] = c + a.z() * a.z() * k;
+    return t;
+  }
+
+  affine_transform operator*(const affine_transform &b) const {
+    // The transform that applies b first and then this one.
+    affine_transform t;
+    for (int i = 0; i < 3; i++) {
+      for (int j = 0; j < 4; j++) {
+        t.m[i][j] = m[i][0] * b.m[0][j] + m[i][1] * b.m[1][j] + m[i][2] * b.m[2][j];
+      }
+      t.m[i][3] += m[i][3];
+    }
+    return t;
+  }
+
+  point3 point(const point3 &p) const {
+    return point3(m[0][0] * p.x() + m[0][1] * p.y() + m[0][2] * p.z() + m[0][3],
+                  m[1][0] * p.x() + m[1][1] * p.y() + m[1][2] * p.z() + m[1][3],
+                  m[2][0] * p.x() + m[2][1] * p.y() + m[2][2] * p.z() + m[2][3]);
+  }
+
+  vec3 vector(const vec3 &v) const {
+    return vec3(m[0][0] * v.x() + m[0][1] * v.y() + m[0][2] * v.z(),
+                m[1][0] * v.x() + m[1][1] * v.y() + m[1][2] * v.z(),
+                m[2][0] * v.x() + m[2][1] * v.y() + m[2][2] * v.z());
+  }
+
+  vec3 transposed_vector(const vec3 &v) const {
+    // Multiply by the transpose of the linear part. Done with the inverse of a transform, this
+    // carries normals through the transform itself.
+    return vec3(m[0][0] * v.x() + m[1][0] * v.y() + m[2][0] * v.z(),
+                m[0][1] * v.x() + m[1][1] * v.y() + m[2][1] * v.z(),
+                m[0][2] * v.x() + m[1][2] * v.y() + m[2][2] * v.z());
+  }
+
+  real determinant() const {
+    // Of the linear part: how much the transform scales volumes.
+    return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+           m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+           m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+  }
+
+  affine_transform inverse() const {
+    // Invert the linear part with its adjugate, then undo the translation.
+    affine_transform t;
+    t.m[0][0] = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+    t.m[0][1] = m[0][2] * m[2][1] - m[0][1] * m[2][2];
+    t.m[0][2] = m[0][1] * m[1][2] - m[0][2] * m[1][1];
+    t.m[1][0] = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+    t.m[1][1] = m[0][0] * m[2][2] - m[0][2] * m[2][0];
+    t.m[1][2] = m[0][2] * m[1][0] - m[0][0] * m[1][2];
+    t.m[2][0] = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+    t.m[2][1] = m[0][1] * m[2][0] - m[0][0] * m[2][1];
+    t.m[2][2] = m[0][0] * m[1][1] - m[0][1] * m[1][0];
+
+    auto det = m[0][0] * t.m[0][0] + m[0][1] * t.m[1][0] + m[0][2] * t.m[2][0];
+    for (int i = 0; i < 3; i++) {
+      for (int j = 0; j < 3; j++) {
+        t.m[i][j] /= det;
+      }
+    }
+    auto offset = t.vector(vec3(m[0][3], m[1][3], m[2][3]));
+    for (int i = 0; i < 3; i++) {
+      t.m[i][3] = -offset[i];
+    }
+    return t;
+  }
+
+  aabb box(const aabb &b) const {
+    // Bounds of the transformed box (Arvo, "Transforming Axis-Aligned Bounding Boxes"): each
+    // output extent is the translation plus the smaller and larger of every term.
+    if (b.x.min > b.x.max || b.y.min > b.y.max || b.z.min > b.z.max) {
+      return b;
+    }
+
+    interval axes[3];
+    for (int i = 0; i < 3; i++) {
+      auto low = m[i][3], high = m[i][3];
+      for (int j = 0; j < 3; j++) {
+        auto a = m[i][j] * b.axis(j).min;
+        auto c = m[i][j] * b.axis(j).max;
+        low += fmin(a, c);
+        high += fmax(a, c);
+      }
+      axes[i] = interval(low, high);
+    }
+    return aabb(axes[0], axes[1], axes[2]);
+  }
+};
+
+#endif
@@ -1,67 +1,76 @@
 #ifndef TRIANGLE_H
 #define TRIANGLE_H
 
+#include "common.h"
 #include "hittable.h"
-#include "vec3.h"
 
 class triangle : public hittable {
+  // A single free standing triangle. The edges and the normal are computed once here, so a
+  // hit costs one Moller-Trumbore test. Large numbers of triangles belong in a triangle_mesh,
+  // which shares vertices between them and has its own BVH.
  public:
-  triangle(point3 _p0, point3 _p1, point3 _p2) : p0(_p0), p1(_p1), p2(_p2) {}
-
-  bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
-    // TODO explain Cramer's rule here
-    // TODO refactor into it's own method.
-    float tval;
-    float A = p0.x() - p1.x();
-    float B = p0.y() - p1.y();
-    float C = p0.z() - p1.z();
-
-    float D = p0.x() - p2.x();
-    float E = p0.y() - p2.y();
-    float F = p0.z() - p2.z();
-
-    float G = r.direction().x();
-    float H = r.direction().y();
-    float I = r.direction().z();
-
-    float J = p0.x() - r.origin().x();
-    float K = p0.y() - r.origin().y();
-    float L = p0.z() - r.origin().z();
+  triangle(const point3 &_p0, const point3 &_p1, const point3 &_p2, shared_ptr<material> m)
+      : p0(_p0), e1(_p1 - _p0), e2(_p2 - _p0), mat(m) {
+    normal = unit_vector(cross(e1, e2));
+    uv_density = 1 / sqrt(e1.length() * e2.length());
+    bbox = aabb(aabb(_p0, _p1), aabb(_p2, _p2));
+  }
 
-    float EIHF = E * I - H * F;
-    float GFDI = G * F - D * I;
-    float DHEG = D * H - E * G;
+  aabb bounding_box() const override {
+    return bbox;
+  }
 
-    float denominator = (A * EIHF + B * GFDI + C * DHEG);
-    float beta = (J * EIHF + K * GFDI + L * DHEG) / denominator;
+  bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
+    // Solve origin + t * direction = p0 + beta * e1 + gamma * e2 with Cramer's rule, written
+    // in terms of scalar triple products.
+    HEMERA_COUNT(stat_triangle_tests);
+    vec3 pvec = cross(r.direction(), e2);
+    auto det = dot(e1, pvec);
+    // No hit if the ray is parallel to the triangle.
+    if (fabs(det) < 1e-12) {
+      return false;
+    }
+    auto inv_det = 1 / det;
 
-    if (beta <= 0.0f || beta >= 1.0f)
+    vec3 tvec = r.origin() - p0;
+    auto beta = dot(tvec, pvec) * inv_det;
+    if (beta < 0 || beta > 1) {
       return false;
+    }
 
-    float AKJB = A * K - J * B;
-    float JCAL = J * K - A * L;
-    float BLKC = B * L - K * C;
+    vec3 qvec = cross(tvec, e1);
+    auto gamma = dot(r.direction(), qvec) * inv_det;
+    if (gamma < 0 || beta + gamma > 1) {
+      return false;
+    }
 
-    float gamma = (I * AKJB + H * JCAL + G * BLKC) / denominator;
-    if (gamma <= 0.0f || beta + gamma >= 1.0f)
+    auto t = dot(e2, qvec) * inv_det;
+    if (!ray_t.surrounds(t)) {
       return false;
+    }
 
-    tval = -(F * AKJB + E * JCAL + D * BLKC) / denominator;
+    HEMERA_COUNT(stat_triangle_hits);
+    rec.t = t;
+    rec.u = beta;
+    rec.v = gamma;
+    rec.object = this;
+    return true;
+  }
 
-    if (ray_t.contains(tval)) {
-      rec.t = tval;
-      rec.normal = unit_vector(cross((p1 - p0), (p2 - p0)));
-      vec3 outward_normal = unit_vector(cross((p1 - p0), (p2 - p0)));
-      rec.set_face_normal(r, outward_normal);
-      return true;
-    }
-    return false;
+  void finalize(const ray &r, hit_record &rec) const override {
+    rec.p = r.at(rec.t);
+    rec.mat = mat.get();
+    rec.set_face_normal(r, normal);
+    rec.uv_density = uv_density;
   }
 
  private:
   point3 p0;
-  point3 p1;
-  point3 p2;
+  vec3 e1, e2;  // Edges from p0 to the other two corners.
+  vec3 normal;
+  real uv_density;  // The barycentrics are the texture coordinates.
+  shared_ptr<material> mat;
+  aabb bbox;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,346 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include "common.h"
+
+#include "bvh.h"
+#include "hittable.h"
+#include "mapped_file.h"
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+struct mesh_data {
+  // Indexed triangles: triangle i uses the vertices indices[3i], indices[3i + 1] and
+  // indices[3i + 2]. Normals and uvs are optional, but when present there is one per vertex.
+  std::vector<point3> positions;
+  std::vector<vec3> normals;
+  std::vector<real> uvs;  // Two per vertex.
+  std::vector<uint32_t> indices;
+
+  size_t triangle_count() const {
+    return indices.size() / 3;
+  }
+};
+
+struct mesh_arrays {
+  // The arrays a triangle_mesh renders from, wherever they are stored: its vertices, and its
+  // triangles and their unit geometric normals in BVH leaf order. normals and uvs are null when
+  // the mesh has none.
+  const point3 *positions = nullptr;
+  const vec3 *normals = nullptr;
+  const real *uvs = nullptr;  // Two per vertex.
+  const uint32_t *indices = nullptr;
+  const vec3 *face_normals = nullptr;
+  size_t vertex_count = 0;
+  size_t triangle_count = 0;
+};
+
+class watertight_ray {
+  // Per ray setup of the watertight ray/triangle test (Woop, Benthin and Wald, "Watertight
+  // Ray/Triangle Intersection"). The vertices are moved into a space where the ray starts at
+  // the origin and runs along +z, and the hit is decided by the signs of 2D edge functions.
+  // Neighbouring triangles evaluate their shared edge from the same two vertices, so a ray
+  // can't slip through the crack between them. That rules out storing edge vectors per
+  // triangle, as the standalone triangle does: p0 + (p1 - p0) needn't round back to p1. A leaf
+  // ordered copy of each triangle's vertices would keep the test exact, but it measured slower
+  // than reading them through the indices, so the per triangle data is the face normal only.
+ public:
+  watertight_ray() {}
+
+  explicit watertight_ray(const ray &r) : origin(r.origin()) {
+    const auto &d = r.direction();
+    kz = fabs(d.x()) > fabs(d.y()) ? (fabs(d.x()) > fabs(d.z()) ? 0 : 2)
+                                   : (fabs(d.y()) > fabs(d.z()) ? 1 : 2);
+    kx = (kz + 1) % 3;
+    ky = (kx + 1) % 3;
+    if (d[kz] < 0) {
+      std::swap(kx, ky);  // Keep the winding of the triangles.
+    }
+    shear_x = d[kx] / d[kz];
+    shear_y = d[ky] / d[kz];
+    shear_z = 1 / d[kz];
+  }
+
+  bool hit(const point3 &p0,
+           const point3 &p1,
+           const point3 &p2,
+           const interval &ray_t,
+           real &t,
+           real &b1,
+           real &b2) const {
+    // On a hit inside ray_t, set t and the barycentric weights of p1 and p2.
+    vec3 a = p0 - origin, b = p1 - origin, c = p2 - origin;
+    auto ax = a[kx] - shear_x * a[kz], ay = a[ky] - shear_y * a[kz];
+    auto bx = b[kx] - shear_x * b[kz], by = b[ky] - shear_y * b[kz];
+    auto cx = c[kx] - shear_x * c[kz], cy = c[ky] - shear_y * c[kz];
+
+    auto u = edge_function(cx, cy, bx, by);
+    auto v = edge_function(ax, ay, cx, cy);
+    auto w = edge_function(bx, by, ax, ay);
+    if ((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0)) {
+      return false;
+    }
+    auto det = u + v + w;
+    if (det == 0) {
+      return false;
+    }
+
+    auto scaled_t = (u * a[kz] + v * b[kz] + w * c[kz]) * shear_z;
+    t = scaled_t / det;
+    if (!ray_t.surrounds(t)) {
+      return false;
+    }
+    b1 = v / det;
+    b2 = w / det;
+    return true;
+  }
+
+ private:
+  point3 origin;
+  int kx, ky, kz;  // Axes permuted so the largest direction component is kz.
+  real shear_x, shear_y, shear_z;
+
+  static real edge_function(real px, real py, real qx, real qy) {
+    // px * qy - py * qx, evaluated with the two endpoints in a fixed order. The triangles on
+    // either side of an edge then get exactly opposite values, even when the compiler fuses
+    // the products into FMA instructions, which would otherwise round them differently.
+    if (px < qx || (px == qx && py < qy)) {
+      return px * qy - py * qx;
+    }
+    return -(qx * py - qy * px);
+  }
+};
+
+class triangle_mesh : public hittable {
+  // A triangle mesh with shared vertex buffers and its own BVH over the triangles. The
+  // triangles are stored in the BVH's leaf order, so a leaf reads a contiguous run of indices,
+  // and their geometric normals are computed once when the mesh is built. A mesh built earlier
+  // can also be rendered straight from a mapped file (see mesh_cache.h).
+ public:
+  triangle_mesh(mesh_data data, shared_ptr<material> m)
+      : triangle_mesh(std::move(data), m, bvh_build_options()) {}
+
+  triangle_mesh(mesh_data data, shared_ptr<material> m, const bvh_build_options &options)
+      : mesh(std::move(data)), mat(m) {
+    auto count = mesh.triangle_count();
+    mesh.indices.resize(3 * count);
+
+    std::vector<aabb> bounds;
+    bounds.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+      const auto &p0 = mesh.positions[mesh.indices[3 * i]];
+      const auto &p1 = mesh.positions[mesh.indices[3 * i + 1]];
+      const auto &p2 = mesh.positions[mesh.indices[3 * i + 2]];
+      bounds.push_back(aabb(aabb(p0, p1), aabb(p2, p2)));
+    }
+    tree.build(bounds, options);
+    bounds = std::vector<aabb>();
+
+    std::vector<uint32_t> leaf_order(3 * count);
+    face_normals.resize(count);
+    for (size_t i = 0; i < count; i++) {
+      auto source = tree.primitive(i);
+      for (int k = 0; k < 3; k++) {
+        leaf_order[3 * i + k] = mesh.indices[3 * source + k];
+      }
+      const auto &p0 = mesh.positions[leaf_order[3 * i]];
+      auto n = cross(mesh.positions[leaf_order[3 * i + 1]] - p0,
+                     mesh.positions[leaf_order[3 * i + 2]] - p0);
+      auto length = n.length();
+      face_normals[i] = length > 0 ? n / length : vec3(0, 0, 1);
+    }
+    mesh.indices.swap(leaf_order);
+
+    geometry.positions = mesh.positions.data();
+    geometry.normals = mesh.normals.empty() ? nullptr : mesh.normals.data();
+    geometry.uvs = mesh.uvs.empty() ? nullptr : mesh.uvs.data();
+    geometry.indices = mesh.indices.data();
+    geometry.face_normals = face_normals.data();
+    geometry.vertex_count = mesh.positions.size();
+    geometry.triangle_count = count;
+  }
+
+  triangle_mesh(shared_ptr<const mapped_file> file,
+                const mesh_arrays &arrays,
+                const wide_bvh_node *nodes,
+                size_t node_count,
+                const aabb &bounds,
+                const bvh_build_stats &stats,
+                shared_ptr<material> m)
+      : mat(m), mapping(file), geometry(arrays) {
+    // Render from arrays and BVH nodes that point into file, which the mesh keeps mapped.
+    tree.adopt(nodes, node_count, bounds, stats);
+  }
+
+  bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
+    // Find the closest triangle and record its index and barycentrics; finalize() interpolates
+    // the vertex attributes.
+    watertight_ray wr(r);
+    int closest = -1;
+    real closest_b1 = 0, closest_b2 = 0;
+
+    tree.hit(r, ray_t, [&](int first, int count, interval &leaf_t) {
+      bool hit_anything = false;
+      for (int i = first; i < first + count; i++) {
+        real t, b1, b2;
+        if (intersect(wr, i, leaf_t, t, b1, b2)) {
+          leaf_t.max = t;
+          closest = i;
+          closest_b1 = b1;
+          closest_b2 = b2;
+          hit_anything = true;
+        }
+      }
+      return hit_anything;
+    });
+
+    if (closest < 0) {
+      return false;
+    }
+    record(ray_t.max, closest, closest_b1, closest_b2, rec);
+    return true;
+  }
+
+  int hit_packet(const ray_packet &packet,
+                 real t_min,
+                 real t_max[],
+                 hit_record rec[],
+                 int active) const override {
+    // One traversal for the packet, testing each leaf's triangles against the lanes that
+    // reached it.
+    const int n = ray_packet::size;
+    int closest[n];
+    real closest_b1[n], closest_b2[n];
+    watertight_ray lane_rays[n];
+    for (int k = 0; k < n; k++) {
+      closest[k] = -1;
+      if (active & (1 << k)) {
+        lane_rays[k] = watertight_ray(packet.rays[k]);
+      }
+    }
+
+    auto hit_leaf = [&](int first, int count, int lanes) {
+      int leaf_hits = 0;
+      for (int k = 0; k < n; k++) {
+        if (!(lanes & (1 << k))) {
+          continue;
+        }
+        interval lane_t(t_min, t_max[k]);
+        for (int i = first; i < first + count; i++) {
+          real t, b1, b2;
+          if (intersect(lane_rays[k], i, lane_t, t, b1, b2)) {
+            lane_t.max = t;
+            closest[k] = i;
+            closest_b1[k] = b1;
+            closest_b2[k] = b2;
+            leaf_hits |= 1 << k;
+          }
+        }
+        t_max[k] = lane_t.max;
+      }
+      return leaf_hits;
+    };
+    int hits = tree.hit_packet(packet, t_min, t_max, active, hit_leaf);
+
+    for (int k = 0; k < n; k++) {
+      if (hits & (1 << k)) {
+        record(t_max[k], closest[k], closest_b1[k], closest_b2[k], rec[k]);
+      }
+    }
+    return hits;
+  }
+
+  void finalize(const ray &r, hit_record &rec) const override {
+    const auto *v = &geometry.indices[3 * rec.primitive];
+    auto b1 = rec.u, b2 = rec.v;
+    auto b0 = 1 - b1 - b2;
+
+    rec.p = r.at(rec.t);
+    rec.mat = mat.get();
+
+    // Interpolated vertex normals shade smoothly, but front_face must come from the geometric
+    // normal or rays grazing a silhouette would see the wrong side.
+    rec.set_face_normal(r, geometry.face_normals[rec.primitive]);
+    if (geometry.normals) {
+      const auto *n = geometry.normals;
+      auto shading = b0 * n[v[0]] + b1 * n[v[1]] + b2 * n[v[2]];
+      auto length = shading.length();
+      if (length > 0) {
+        rec.normal = (rec.front_face ? shading : -shading) / length;
+      }
+    }
+
+    // Texture units per length, from the ratio of the triangle's area in texture space to
+    // its area in the world. Without uvs the barycentrics are the texture coordinates.
+    const auto *p = geometry.positions;
+    auto world_area = cross(p[v[1]] - p[v[0]], p[v[2]] - p[v[0]]).length();
+    real uv_area = 1;
+    if (geometry.uvs) {
+      const auto *uv = geometry.uvs;
+      rec.u = b0 * uv[2 * v[0]] + b1 * uv[2 * v[1]] + b2 * uv[2 * v[2]];
+      rec.v = b0 * uv[2 * v[0] + 1] + b1 * uv[2 * v[1] + 1] + b2 * uv[2 * v[2] + 1];
+      uv_area = std::fabs((uv[2 * v[1]] - uv[2 * v[0]]) * (uv[2 * v[2] + 1] - uv[2 * v[0] + 1]) -
+                          (uv[2 * v[2]] - uv[2 * v[0]]) * (uv[2 * v[1] + 1] - uv[2 * v[0] + 1]));
+    }
+    rec.uv_density = world_area > 0 ? std::sqrt(uv_area / world_area) : 0;
+  }
+
+  aabb bounding_box() const override {
+    return tree.bounds();
+  }
+
+  size_t triangle_count() const {
+    return geometry.triangle_count;
+  }
+
+  const mesh_arrays &arrays() const {
+    return geometry;
+  }
+
+  const wide_bvh &bvh() const {
+    return tree;
+  }
+
+  void print(std::ostream &out) const {
+    out << "Mesh: " << geometry.vertex_count << " vertices, " << geometry.triangle_count
+        << " triangles" << (mapping ? ", mapped from its cache file" : "") << '\n';
+  }
+
+ private:
+  // A built mesh owns its arrays in mesh and face_normals; a mapped one keeps its file mapped.
+  mesh_data mesh;
+  std::vector<vec3> face_normals;
+  shared_ptr<material> mat;
+  shared_ptr<const mapped_file> mapping;
+  mesh_arrays geometry;
+  wide_bvh tree;
+
+  bool intersect(const watertight_ray &wr,
+                 int i,
+                 const interval &ray_t,
+                 real &t,
+                 real &b1,
+                 real &b2) const {
+    HEMERA_COUNT(stat_mesh_triangle_tests);
+    const auto *v = &geometry.indices[3 * i];
+    const auto *p = geometry.positions;
+    if (!wr.hit(p[v[0]], p[v[1]], p[v[2]], ray_t, t, b1, b2)) {
+      return false;
+    }
+    HEMERA_COUNT(stat_mesh_triangle_hits);
+    return true;
+  }
+
+  void record(real t, int i, real b1, real b2, hit_record &rec) const {
+    // Without uvs, the barycentrics recorded here double as the texture coordinates.
+    rec.t = t;
+    rec.u = b1;
+    rec.v = b2;
+    rec.object = this;
+    rec.primitive = i;
+  }
+};
+
+#endif
@@ -30,8 +30,9 @@ class uv_image {
 
     // Hunt for the image file in some likely locations.
     if (imagedir && load(std::string(imagedir) + "/" + image_filename))
-      if (load(filename))
-        return;
+      return;
+    if (load(filename))
+      return;
     if (load("images/" + filename))
       return;
     if (load("../images/" + filename))
@@ -1,145 +1,183 @@
 #ifndef VEC3_H
 #define VEC3_H
 
+#include "simd.h"
+
 #include <cmath>
 #include <iostream>
 
 using std::sqrt;
 
-class vec3 {
+// By default a vec3 is three plain scalars. HEMERA_SIMD_VEC3 (make VEC3=simd) keeps the
+// components in SIMD lanes instead, making the component wise operators single SSE (float) or
+// AVX (double) instructions, at the cost of a padding lane. On x86 it measured no faster: the
+// shading code mostly reads single components and takes dot and cross products, which need the
+// lanes split apart again.
+#ifdef HEMERA_SIMD_VEC3
+template <typename T>
+using vec3_lanes = simd_lanes<T>;
+#else
+template <typename T>
+using vec3_lanes = scalar_lanes<T>;
+#endif
+
+template <typename T>
+class basic_vec3 {
+  // A 3D vector over the scalar type T. The renderer uses the vec3 alias below, whose scalar
+  // is selected at build time.
  public:
-  double e[3];
+  using scalar = T;
+
+  vec3_lanes<T> v;
+
+  basic_vec3() : v(vec3_lanes<T>::broadcast(0)) {}
+  basic_vec3(T e0, T e1, T e2) : v(vec3_lanes<T>::set(e0, e1, e2)) {}
+  explicit basic_vec3(vec3_lanes<T> lanes) : v(lanes) {}
 
-  vec3() : e{0, 0, 0} {}
-  vec3(double e0, double e1, double e2) : e{e0, e1, e2} {}
+  template <typename U>
+  explicit basic_vec3(const basic_vec3<U> &u)
+      : v(vec3_lanes<T>::set(
+            static_cast<T>(u.x()), static_cast<T>(u.y()), static_cast<T>(u.z()))) {}
 
-  double x() const {
-    return e[0];
+  T x() const {
+    return v.get(0);
   }
-  double y() const {
-    return e[1];
+  T y() const {
+    return v.get(1);
   }
-  double z() const {
-    return e[2];
+  T z() const {
+    return v.get(2);
   }
 
-  vec3 operator-() const {
-    return vec3(-e[0], -e[1], -e[2]);
+  basic_vec3 operator-() const {
+    // Multiplying keeps the sign of zero components, which the BVH's slab test relies on.
+    return basic_vec3(vec3_lanes<T>::broadcast(-1) * v);
   }
-  double operator[](int i) const {
-    return e[i];
+  T operator[](int i) const {
+    return v.get(i);
   }
-  double &operator[](int i) {
-    return e[i];
+  T &operator[](int i) {
+    return v.data()[i];
   }
 
-  vec3 &operator+=(const vec3 &v) {
-    e[0] += v.e[0];
-    e[1] += v.e[1];
-    e[2] += v.e[2];
+  basic_vec3 &operator+=(const basic_vec3 &u) {
+    v = v + u.v;
     return *this;
   }
 
-  vec3 &operator*=(double t) {
-    e[0] *= t;
-    e[1] *= t;
-    e[2] *= t;
+  basic_vec3 &operator*=(T t) {
+    v = v * vec3_lanes<T>::broadcast(t);
     return *this;
   }
 
-  vec3 &operator/=(double t) {
+  basic_vec3 &operator/=(T t) {
     return *this *= 1 / t;
   }
 
-  double length() const {
+  T length() const {
     return sqrt(length_squared());
   }
 
-  double length_squared() const {
-    return e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
+  T length_squared() const {
+    return x() * x() + y() * y() + z() * z();
   }
 
   bool near_zero() const {
     //  Returns true if the vector is close to zero in all dimensions.
-    auto s = 1e-8;
-    return (fabs(e[0]) < s) && (fabs(e[1]) < s) && (fabs(e[2]) < s);
+    T s = 1e-8;
+    return (std::fabs(x()) < s) && (std::fabs(y()) < s) && (std::fabs(z()) < s);
   }
 
-  static vec3 random() {
-    return vec3(random_double(), random_double(), random_double());
+  static basic_vec3 random() {
+    return basic_vec3(random_double(), random_double(), random_double());
   }
 
-  static vec3 random(double min, double max) {
-    return vec3(random_double(min, max), random_double(min, max), random_double(min, max));
+  static basic_vec3 random(T min, T max) {
+    return basic_vec3(random_double(min, max), random_double(min, max), random_double(min, max));
   }
 };
 
+using vec3 = basic_vec3<real>;
+
 // point3 is just an alias for vec3, but useful for geometric clarity in the code.
 using point3 = vec3;
 
-// Vector Utility Functions
+// Vector Utility Functions. Scalar operands take the vector's scalar type, so literals and
+// doubles convert instead of failing template deduction.
 
-inline std::ostream &operator<<(std::ostream &out, const vec3 &v) {
-  return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
+template <typename T>
+inline std::ostream &operator<<(std::ostream &out, const basic_vec3<T> &v) {
+  return out << v.x() << ' ' << v.y() << ' ' << v.z();
 }
 
-inline vec3 operator+(const vec3 &u, const vec3 &v) {
-  return vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
+template <typename T>
+inline basic_vec3<T> operator+(const basic_vec3<T> &u, const basic_vec3<T> &v) {
+  return basic_vec3<T>(u.v + v.v);
 }
 
-inline vec3 operator-(const vec3 &u, const vec3 &v) {
-  return vec3(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
+template <typename T>
+inline basic_vec3<T> operator-(const basic_vec3<T> &u, const basic_vec3<T> &v) {
+  return basic_vec3<T>(u.v - v.v);
 }
 
-inline vec3 operator*(const vec3 &u, const vec3 &v) {
-  return vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
+template <typename T>
+inline basic_vec3<T> operator*(const basic_vec3<T> &u, const basic_vec3<T> &v) {
+  return basic_vec3<T>(u.v * v.v);
 }
 
-inline vec3 operator*(double t, const vec3 &v) {
-  return vec3(t * v.e[0], t * v.e[1], t * v.e[2]);
+template <typename T>
+inline basic_vec3<T> operator*(typename basic_vec3<T>::scalar t, const basic_vec3<T> &v) {
+  return basic_vec3<T>(vec3_lanes<T>::broadcast(t) * v.v);
 }
 
-inline vec3 operator*(const vec3 &v, double t) {
+template <typename T>
+inline basic_vec3<T> operator*(const basic_vec3<T> &v, typename basic_vec3<T>::scalar t) {
   return t * v;
 }
 
-inline vec3 operator/(vec3 v, double t) {
+template <typename T>
+inline basic_vec3<T> operator/(basic_vec3<T> v, typename basic_vec3<T>::scalar t) {
   return (1 / t) * v;
 }
 
-inline double dot(const vec3 &u, const vec3 &v) {
-  return u.e[0] * v.e[0] + u.e[1] * v.e[1] + u.e[2] * v.e[2];
+template <typename T>
+inline T dot(const basic_vec3<T> &u, const basic_vec3<T> &v) {
+  return u.x() * v.x() + u.y() * v.y() + u.z() * v.z();
 }
 
-inline vec3 cross(const vec3 &u, const vec3 &v) {
-  return vec3(u.e[1] * v.e[2] - u.e[2] * v.e[1],
-              u.e[2] * v.e[0] - u.e[0] * v.e[2],
-              u.e[0] * v.e[1] - u.e[1] * v.e[0]);
+template <typename T>
+inline basic_vec3<T> cross(const basic_vec3<T> &u, const basic_vec3<T> &v) {
+  return basic_vec3<T>(u.y() * v.z() - u.z() * v.y(),
+                       u.z() * v.x() - u.x() * v.z(),
+                       u.x() * v.y() - u.y() * v.x());
 }
 
-inline vec3 unit_vector(vec3 v) {
+template <typename T>
+inline basic_vec3<T> unit_vector(basic_vec3<T> v) {
   return v / v.length();
 }
 
 inline vec3 random_in_unit_disk() {
-  while (true) {
-    auto p = vec3(random_double(-1, 1), random_double(-1, 1), 0);
-    if (p.length_squared() < 1) {
-      return p;
-    }
-  }
+  // Polar mapping of two uniform numbers: the square root of the radius spreads the points
+  // evenly over the area. Unlike rejection sampling it costs the same every time, with no
+  // unpredictable branch.
+  auto r = sqrt(random_double());
+  auto phi = 2 * pi * random_double();
+  return vec3(r * cos(phi), r * sin(phi), 0);
 }
 
-inline vec3 random_in_unit_sphere() {
-  while (true) {
-    auto p = vec3::random(-1, 1);
-    if (p.length_squared() < 1)
-      return p;
-  }
+inline vec3 random_unit_vector() {
+  // By Archimedes' hat-box theorem, z is uniform in [-1, 1] for points uniform on the sphere,
+  // so the direction is a height plus an independent angle around the z axis.
+  auto z = 1 - 2 * random_double();
+  auto r = sqrt(1 - z * z);
+  auto phi = 2 * pi * random_double();
+  return vec3(r * cos(phi), r * sin(phi), z);
 }
 
-inline vec3 random_unit_vector() {
-  return unit_vector(random_in_unit_sphere());
+inline vec3 random_in_unit_sphere() {
+  // A direction, scaled by the cube root of a uniform number so the volume is evenly filled.
+  return std::cbrt(random_double()) * random_unit_vector();
 }
 
 inline vec3 random_on_hemisphere(const vec3 &normal) {
@@ -153,14 +191,18 @@ inline vec3 random_on_hemisphere(const vec3 &normal) {
   }
 }
 
-inline vec3 reflect(const vec3 &v, const vec3 &n) {
+template <typename T>
+inline basic_vec3<T> reflect(const basic_vec3<T> &v, const basic_vec3<T> &n) {
   return v - 2 * dot(v, n) * n;
 }
 
-inline vec3 refract(const vec3 &uv, const vec3 &n, double etai_over_etat) {
-  auto cos_theta = fmin(dot(-uv, n), 1.0);
-  vec3 r_out_perp = etai_over_etat * (uv + cos_theta * n);
-  vec3 r_out_parallel = -sqrt(fabs(1.0 - r_out_perp.length_squared())) * n;
+template <typename T>
+inline basic_vec3<T> refract(const basic_vec3<T> &uv,
+                             const basic_vec3<T> &n,
+                             typename basic_vec3<T>::scalar etai_over_etat) {
+  auto cos_theta = std::fmin(dot(-uv, n), T(1));
+  basic_vec3<T> r_out_perp = etai_over_etat * (uv + cos_theta * n);
+  basic_vec3<T> r_out_parallel = -sqrt(std::fabs(1 - r_out_perp.length_squared())) * n;
   return r_out_perp + r_out_parallel;
 }
 
@@ -1,7 +1,3 @@
 #! /bin/bash
 
-./hemera > $1.ppm
-
-ffmpeg -i $1.ppm $1.png
-
-rm $1.ppm
\ No newline at end of file
+./hemera -o $1.png ${2:-scenes/final_scene.scene}